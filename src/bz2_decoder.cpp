@@ -0,0 +1,341 @@
+//========================================================//
+//  bz2_decoder.cpp                                       //
+//  Source file for the block-parallel bzip2 decoder      //
+//                                                        //
+//  bzip2 blocks start with a 48-bit magic at an          //
+//  arbitrary bit offset and can be decoded on their own  //
+//  once re-wrapped as a single-block stream              //
+//========================================================//
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <bzlib.h>
+#include "bz2_decoder.h"
+
+// Block header and end-of-stream magics (BCD pi and sqrt(pi))
+#define BLOCK_MAGIC 0x314159265359ULL
+#define EOS_MAGIC 0x177245385090ULL
+#define MAGIC_BITS 48
+
+// A false block magic inside compressed data makes the block before it
+// fail to decode; it is then retried up to this many markers further
+#define MAX_EXTEND 16
+
+#define SLOT_FREE 0
+#define SLOT_BUSY 1
+#define SLOT_DONE 2
+
+// Decoded output of one block
+typedef struct
+{
+  int marker;       // Marker index of the block held, -1 if none
+  int state;
+  int ok;
+  int end_marker;   // First marker past the decoded block
+  uint8_t *in;      // Re-wrapped single-block stream
+  size_t in_cap;
+  uint8_t *out;
+  size_t out_len;
+  size_t out_cap;
+} bz2_slot;
+
+struct bz2_decoder
+{
+  const uint8_t *data;
+  size_t len;
+
+  // Bit offsets of every block and end-of-stream magic, in file order
+  uint64_t *marker_pos;
+  uint8_t *marker_is_block;
+  int num_markers;
+
+  bz2_slot *slots;  // Ring indexed by marker index
+  int window;
+  int next_job;     // Next marker a worker should pick up
+  int base;         // Marker of the block the consumer holds or awaits
+  int started;
+  int done;
+  int stop;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  int num_threads;
+  pthread_t *threads;
+};
+
+int bz2_is_compressed(const uint8_t *data, size_t len)
+{
+  return len >= 4 && data[0] == 'B' && data[1] == 'Z' && data[2] == 'h' &&
+         data[3] >= '1' && data[3] <= '9';
+}
+
+// Record the position of every block and end-of-stream magic
+//
+static void find_markers(bz2_decoder *d)
+{
+  int cap = 1024;
+  d->marker_pos = (uint64_t *)malloc(cap * sizeof(uint64_t));
+  d->marker_is_block = (uint8_t *)malloc(cap);
+  d->num_markers = 0;
+
+  uint64_t w = 0;
+  for (size_t i = 0; i < d->len; i++)
+  {
+    uint8_t byte = d->data[i];
+    for (int b = 7; b >= 0; b--)
+    {
+      w = (w << 1) | ((byte >> b) & 1);
+      uint64_t m = w & ((1ULL << MAGIC_BITS) - 1);
+      if (m != BLOCK_MAGIC && m != EOS_MAGIC)
+        continue;
+
+      uint64_t end = i * 8 + (8 - b);
+      if (end < MAGIC_BITS)
+        continue;
+      if (d->num_markers == cap)
+      {
+        cap *= 2;
+        d->marker_pos = (uint64_t *)realloc(d->marker_pos, cap * sizeof(uint64_t));
+        d->marker_is_block = (uint8_t *)realloc(d->marker_is_block, cap);
+      }
+      d->marker_pos[d->num_markers] = end - MAGIC_BITS;
+      d->marker_is_block[d->num_markers] = (m == BLOCK_MAGIC);
+      d->num_markers++;
+    }
+  }
+}
+
+// Read the 8 bits starting at bit 'pos'
+//
+static uint8_t get_byte(const bz2_decoder *d, uint64_t pos)
+{
+  size_t i = pos >> 3;
+  int sh = pos & 7;
+  uint8_t v = d->data[i] << sh;
+  if (sh && i + 1 < d->len)
+    v |= d->data[i + 1] >> (8 - sh);
+  return v;
+}
+
+static void put_bits(uint8_t *buf, uint64_t *pos, uint64_t v, int n)
+{
+  for (int b = n - 1; b >= 0; b--, (*pos)++)
+  {
+    if ((v >> b) & 1)
+      buf[*pos >> 3] |= 0x80 >> (*pos & 7);
+  }
+}
+
+// Wrap bits [start, end) of the input, a whole block, into a standalone
+// stream: header, the block, end-of-stream magic and combined CRC. The
+// combined CRC of a single-block stream is the block CRC itself.
+//
+// Returns the stream length in bytes
+//
+static size_t wrap_block(const bz2_decoder *d, bz2_slot *s, uint64_t start, uint64_t end)
+{
+  uint64_t nbits = end - start;
+  size_t need = 4 + (nbits + 80) / 8 + 1;
+  if (s->in_cap < need)
+  {
+    s->in_cap = need;
+    s->in = (uint8_t *)realloc(s->in, need);
+  }
+  memset(s->in, 0, need);
+  memcpy(s->in, "BZh9", 4);
+
+  uint64_t full = nbits / 8;
+  for (uint64_t k = 0; k < full; k++)
+    s->in[4 + k] = get_byte(d, start + 8 * k);
+
+  uint64_t pos = 32 + full * 8;
+  int tail = nbits & 7;
+  if (tail)
+    put_bits(s->in, &pos, get_byte(d, start + full * 8) >> (8 - tail), tail);
+
+  uint32_t crc = 0;
+  for (int k = 0; k < 4; k++)
+    crc = (crc << 8) | get_byte(d, start + MAGIC_BITS + 8 * k);
+  put_bits(s->in, &pos, EOS_MAGIC, MAGIC_BITS);
+  put_bits(s->in, &pos, crc, 32);
+
+  return (pos + 7) / 8;
+}
+
+// Decompress the block spanning bits [start, end) into s->out
+//
+// Returns True if Successful
+//
+static int decode_block(const bz2_decoder *d, bz2_slot *s, uint64_t start, uint64_t end)
+{
+  size_t in_len = wrap_block(d, s, start, end);
+
+  bz_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK)
+    return 0;
+  strm.next_in = (char *)s->in;
+  strm.avail_in = in_len;
+
+  int r;
+  s->out_len = 0;
+  do
+  {
+    if (s->out_cap - s->out_len < (1 << 20))
+    {
+      s->out_cap = s->out_cap ? 2 * s->out_cap : (4 << 20);
+      s->out = (uint8_t *)realloc(s->out, s->out_cap);
+    }
+    strm.next_out = (char *)s->out + s->out_len;
+    strm.avail_out = s->out_cap - s->out_len;
+    r = BZ2_bzDecompress(&strm);
+    s->out_len = (uint8_t *)strm.next_out - s->out;
+  } while (r == BZ_OK && (strm.avail_in > 0 || strm.avail_out == 0));
+
+  BZ2_bzDecompressEnd(&strm);
+  return r == BZ_STREAM_END;
+}
+
+// Decode the block at marker 'm', widening it over false markers
+//
+static void decode_job(const bz2_decoder *d, bz2_slot *s, int m)
+{
+  uint64_t total_bits = (uint64_t)d->len * 8;
+
+  s->ok = 0;
+  for (int e = m + 1; e <= d->num_markers && e <= m + MAX_EXTEND; e++)
+  {
+    uint64_t end = (e < d->num_markers) ? d->marker_pos[e] : total_bits;
+    if (decode_block(d, s, d->marker_pos[m], end))
+    {
+      s->ok = 1;
+      s->end_marker = e;
+      return;
+    }
+  }
+}
+
+static void *worker(void *arg)
+{
+  bz2_decoder *d = (bz2_decoder *)arg;
+
+  pthread_mutex_lock(&d->lock);
+  for (;;)
+  {
+    while (d->next_job < d->num_markers && !d->marker_is_block[d->next_job])
+      d->next_job++;
+    if (d->stop || d->next_job >= d->num_markers)
+      break;
+
+    // Stay within the window of blocks the consumer can take next
+    int m = d->next_job;
+    bz2_slot *s = &d->slots[m % d->window];
+    if (m >= d->base + d->window || s->state == SLOT_BUSY)
+    {
+      pthread_cond_wait(&d->cond, &d->lock);
+      continue;
+    }
+    d->next_job++;
+    s->marker = m;
+    s->state = SLOT_BUSY;
+
+    pthread_mutex_unlock(&d->lock);
+    decode_job(d, s, m);
+    pthread_mutex_lock(&d->lock);
+
+    s->state = SLOT_DONE;
+    pthread_cond_broadcast(&d->cond);
+  }
+  pthread_mutex_unlock(&d->lock);
+  return NULL;
+}
+
+bz2_decoder *bz2_open(const uint8_t *data, size_t len, int threads)
+{
+  bz2_decoder *d = (bz2_decoder *)calloc(1, sizeof(bz2_decoder));
+  d->data = data;
+  d->len = len;
+  find_markers(d);
+  if (d->num_markers == 0 || !d->marker_is_block[0])
+  {
+    free(d->marker_pos);
+    free(d->marker_is_block);
+    free(d);
+    return NULL;
+  }
+
+  d->num_threads = (threads < 1) ? 1 : threads;
+  d->window = 2 * d->num_threads + 1;
+  d->slots = (bz2_slot *)calloc(d->window, sizeof(bz2_slot));
+  for (int i = 0; i < d->window; i++)
+    d->slots[i].marker = -1;
+
+  pthread_mutex_init(&d->lock, NULL);
+  pthread_cond_init(&d->cond, NULL);
+  d->threads = (pthread_t *)malloc(d->num_threads * sizeof(pthread_t));
+  for (int i = 0; i < d->num_threads; i++)
+    pthread_create(&d->threads[i], NULL, worker, d);
+
+  return d;
+}
+
+int bz2_next(bz2_decoder *d, const uint8_t **chunk, size_t *len)
+{
+  if (d->done)
+    return 0;
+
+  pthread_mutex_lock(&d->lock);
+
+  // Release the block handed out last time and skip past it
+  if (d->started)
+  {
+    d->base = d->slots[d->base % d->window].end_marker;
+    pthread_cond_broadcast(&d->cond);
+  }
+  d->started = 1;
+  while (d->base < d->num_markers && !d->marker_is_block[d->base])
+    d->base++;
+  if (d->base >= d->num_markers)
+  {
+    d->done = 1;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+  }
+
+  bz2_slot *s = &d->slots[d->base % d->window];
+  while (s->marker != d->base || s->state != SLOT_DONE)
+    pthread_cond_wait(&d->cond, &d->lock);
+  pthread_mutex_unlock(&d->lock);
+
+  if (!s->ok)
+  {
+    d->done = 1;
+    return -1;
+  }
+  *chunk = s->out;
+  *len = s->out_len;
+  return 1;
+}
+
+void bz2_close(bz2_decoder *d)
+{
+  pthread_mutex_lock(&d->lock);
+  d->stop = 1;
+  pthread_cond_broadcast(&d->cond);
+  pthread_mutex_unlock(&d->lock);
+  for (int i = 0; i < d->num_threads; i++)
+    pthread_join(d->threads[i], NULL);
+
+  for (int i = 0; i < d->window; i++)
+  {
+    free(d->slots[i].in);
+    free(d->slots[i].out);
+  }
+  pthread_mutex_destroy(&d->lock);
+  pthread_cond_destroy(&d->cond);
+  free(d->slots);
+  free(d->threads);
+  free(d->marker_pos);
+  free(d->marker_is_block);
+  free(d);
+}
@@ -0,0 +1,40 @@
+//========================================================//
+//  bz2_decoder.h                                         //
+//  Header file for the block-parallel bzip2 decoder      //
+//                                                        //
+//  Splits a bzip2 file at its block boundaries and       //
+//  decompresses the blocks on worker threads, handing    //
+//  the output back in file order                         //
+//========================================================//
+
+#ifndef BZ2_DECODER_H
+#define BZ2_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct bz2_decoder bz2_decoder;
+
+// Returns True if 'data' starts with a bzip2 stream header
+//
+int bz2_is_compressed(const uint8_t *data, size_t len);
+
+// Start decoding the 'len' bytes at 'data' with 'threads' workers. The
+// data must stay valid until bz2_close.
+//
+// Returns NULL if no bzip2 block is found
+//
+bz2_decoder *bz2_open(const uint8_t *data, size_t len, int threads);
+
+// Fetch the next decompressed chunk. The chunk stays valid until the
+// next call.
+//
+// Returns 1 with a chunk, 0 at end of data, -1 on corrupt data
+//
+int bz2_next(bz2_decoder *d, const uint8_t **chunk, size_t *len);
+
+// Stop the workers and release all buffers
+//
+void bz2_close(bz2_decoder *d);
+
+#endif
@@ -0,0 +1,219 @@
+//========================================================//
+//  convert_trace.cpp                                     //
+//  Converts text branch traces to the binary format      //
+//                                                        //
+//  Reads branchExtractor text (plain or bzip2) and       //
+//  writes packed binary records, see trace.h             //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <bzlib.h>
+#include "trace.h"
+
+// Print out the Usage information to stderr
+//
+void usage()
+{
+  fprintf(stderr, "Usage: convert_trace [<input> [<output>]]\n");
+  fprintf(stderr, "       convert_trace trace.bz2 trace.bpt\n");
+  fprintf(stderr, "       bunzip2 -kc trace.bz2 | convert_trace > trace.bpt\n");
+  fprintf(stderr, " <input>  text trace, plain or bzip2 compressed (default stdin)\n");
+  fprintf(stderr, " <output> binary trace (default stdout)\n");
+}
+
+// A bzip2 input that may consist of several concatenated streams
+//
+typedef struct
+{
+  FILE *raw;
+  BZFILE *bz;
+  int done;
+} bz2_input;
+
+// stdio cookie callbacks so a bzip2 input can be read with getline
+//
+static ssize_t bz2_cookie_read(void *cookie, char *buf, size_t size)
+{
+  bz2_input *in = (bz2_input *)cookie;
+  int bzerror;
+
+  while (!in->done)
+  {
+    int n = BZ2_bzRead(&bzerror, in->bz, buf, (int)size);
+    if (bzerror == BZ_OK)
+    {
+      return n;
+    }
+    if (bzerror != BZ_STREAM_END)
+    {
+      fprintf(stderr, "Error: bzip2 decompression failed (%d)\n", bzerror);
+      return -1;
+    }
+
+    // Continue with the next stream, starting from the bytes bzip2
+    // read ahead past the end of this one
+    void *unused;
+    int num_unused;
+    char carry[BZ_MAX_UNUSED];
+    BZ2_bzReadGetUnused(&bzerror, in->bz, &unused, &num_unused);
+    memcpy(carry, unused, num_unused);
+    BZ2_bzReadClose(&bzerror, in->bz);
+    in->bz = NULL;
+    if (num_unused == 0)
+    {
+      int c = getc(in->raw);
+      if (c == EOF)
+      {
+        in->done = 1;
+      }
+      else
+      {
+        ungetc(c, in->raw);
+      }
+    }
+    if (!in->done)
+    {
+      in->bz = BZ2_bzReadOpen(&bzerror, in->raw, 0, 0, carry, num_unused);
+      if (bzerror != BZ_OK)
+      {
+        return -1;
+      }
+    }
+    if (n > 0)
+    {
+      return n;
+    }
+  }
+  return 0;
+}
+
+static int bz2_cookie_close(void *cookie)
+{
+  bz2_input *in = (bz2_input *)cookie;
+  int bzerror;
+  if (in->bz != NULL)
+  {
+    BZ2_bzReadClose(&bzerror, in->bz);
+  }
+  fclose(in->raw);
+  free(in);
+  return 0;
+}
+
+// Open 'path' for reading, transparently decompressing bzip2 input
+//
+FILE *open_input(const char *path)
+{
+  FILE *raw = fopen(path, "rb");
+  if (raw == NULL)
+  {
+    return NULL;
+  }
+
+  char magic[3];
+  size_t n = fread(magic, 1, 3, raw);
+  rewind(raw);
+  if (n < 3 || memcmp(magic, "BZh", 3))
+  {
+    return raw;
+  }
+
+  int bzerror;
+  bz2_input *in = (bz2_input *)malloc(sizeof(bz2_input));
+  in->raw = raw;
+  in->done = 0;
+  in->bz = BZ2_bzReadOpen(&bzerror, raw, 0, 0, NULL, 0);
+  if (bzerror != BZ_OK)
+  {
+    fclose(raw);
+    free(in);
+    return NULL;
+  }
+  cookie_io_functions_t io = {bz2_cookie_read, NULL, NULL, bz2_cookie_close};
+  return fopencookie(in, "r", io);
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *in = stdin;
+  FILE *out = stdout;
+
+  if (argc > 3 || (argc > 1 && !strcmp(argv[1], "--help")))
+  {
+    usage();
+    exit(argc > 3);
+  }
+  if (argc > 1 && strcmp(argv[1], "-"))
+  {
+    in = open_input(argv[1]);
+    if (in == NULL)
+    {
+      fprintf(stderr, "Error: cannot open %s\n", argv[1]);
+      exit(1);
+    }
+  }
+  if (argc > 2)
+  {
+    out = fopen(argv[2], "wb");
+    if (out == NULL)
+    {
+      fprintf(stderr, "Error: cannot create %s\n", argv[2]);
+      exit(1);
+    }
+  }
+
+  // The record count is patched in at the end when the output is seekable
+  trace_write_header(out, 0);
+
+  char *buf = NULL;
+  size_t len = 0;
+  uint64_t num_records = 0;
+  uint64_t skipped = 0;
+  uint8_t packed[TRACE_BATCH * TRACE_RECORD_BYTES];
+  size_t fill = 0;
+  branch_record rec;
+
+  ssize_t line_len;
+  while ((line_len = getline(&buf, &len, in)) != -1)
+  {
+    int ok;
+    trace_parse_text(buf, buf + line_len, &rec, &ok);
+    if (!ok)
+    {
+      skipped++;
+      continue;
+    }
+    trace_pack(packed + fill * TRACE_RECORD_BYTES, &rec);
+    num_records++;
+    if (++fill == TRACE_BATCH)
+    {
+      fwrite(packed, TRACE_RECORD_BYTES, fill, out);
+      fill = 0;
+    }
+  }
+  fwrite(packed, TRACE_RECORD_BYTES, fill, out);
+
+  if (fseek(out, 0, SEEK_SET) == 0)
+  {
+    trace_write_header(out, num_records);
+  }
+
+  fprintf(stderr, "Records:         %10llu\n", (unsigned long long)num_records);
+  if (skipped)
+  {
+    fprintf(stderr, "Skipped lines:   %10llu\n", (unsigned long long)skipped);
+  }
+
+  // Cleanup
+  free(buf);
+  fclose(in);
+  if (fclose(out) != 0)
+  {
+    fprintf(stderr, "Error: failed writing output\n");
+    return 1;
+  }
+
+  return 0;
+}
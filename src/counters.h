@@ -0,0 +1,95 @@
+//========================================================//
+//  counters.h                                            //
+//  Header file for packed saturating counter tables      //
+//                                                        //
+//  Counters narrower than a byte share bytes, so tables  //
+//  occupy close to the storage they model                //
+//========================================================//
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A table of 'Bits'-bit saturating counters. Each counter sits in a slot
+// of the next power-of-two width, so 2-bit counters pack four per byte
+// and 3-bit counters two per byte, and no counter straddles bytes.
+//
+template <int Bits>
+class CounterTable
+{
+public:
+  static const int SLOT_BITS = (Bits <= 1) ? 1 : (Bits <= 2) ? 2 : (Bits <= 4) ? 4 : 8;
+  static const int PER_BYTE = 8 / SLOT_BITS;
+  static const uint8_t MAX = (1 << Bits) - 1;
+
+  CounterTable() : bytes(NULL), entries(0) {}
+  ~CounterTable() { free(bytes); }
+  CounterTable(const CounterTable &) = delete;
+  CounterTable &operator=(const CounterTable &) = delete;
+
+  // Allocate 'n' counters, all set to 'value'
+  //
+  void init(uint32_t n, uint8_t value)
+  {
+    uint8_t pattern = 0;
+    for (int k = 0; k < PER_BYTE; k++)
+      pattern |= (value & MAX) << (k * SLOT_BITS);
+
+    free(bytes);
+    entries = n;
+    bytes = (uint8_t *)malloc(size_bytes());
+    memset(bytes, pattern, size_bytes());
+  }
+
+  uint8_t get(uint32_t i) const
+  {
+    return (bytes[i / PER_BYTE] >> shift(i)) & MAX;
+  }
+
+  void set(uint32_t i, uint8_t value)
+  {
+    uint8_t &b = bytes[i / PER_BYTE];
+    b = (b & ~(MAX << shift(i))) | ((value & MAX) << shift(i));
+  }
+
+  // Count up or down, saturating at MAX and 0
+  void increment(uint32_t i)
+  {
+    uint8_t v = get(i);
+    if (v < MAX)
+      set(i, v + 1);
+  }
+
+  void decrement(uint32_t i)
+  {
+    uint8_t v = get(i);
+    if (v > 0)
+      set(i, v - 1);
+  }
+
+  // Start loading the byte of counter i, which is about to be updated
+  void prefetch(uint32_t i) const
+  {
+    __builtin_prefetch(&bytes[i / PER_BYTE], 1);
+  }
+
+  // Host memory the table occupies
+  size_t size_bytes() const
+  {
+    return (entries + PER_BYTE - 1) / PER_BYTE;
+  }
+
+  // The packed counters, size_bytes() of them
+  uint8_t *data() { return bytes; }
+
+private:
+  static int shift(uint32_t i) { return (i % PER_BYTE) * SLOT_BITS; }
+
+  uint8_t *bytes;
+  uint32_t entries;
+};
+
+#endif
@@ -0,0 +1,38 @@
+//========================================================//
+//  history.h                                             //
+//  Header file for folded branch histories               //
+//                                                        //
+//  Long global histories are hashed into table indices   //
+//  and tags through registers folded one bit at a time   //
+//========================================================//
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+// A history of 'length' bits folded onto 'width' bits, updated one bit at
+// a time from the history buffer
+struct folded_history {
+    uint32_t comp;
+    int width;
+    int length;
+    int outpoint;   // Where the bit leaving the history lands
+
+    void init(int length, int width) {
+        this->comp = 0;
+        this->width = width;
+        this->length = length;
+        this->outpoint = length % width;
+    }
+
+    // h[0] is the newest outcome, h[length] the one leaving
+    void update(const uint8_t *h) {
+        comp = (comp << 1) ^ h[0];
+        comp ^= (uint32_t)h[length] << outpoint;
+        comp ^= comp >> width;
+        comp &= (1u << width) - 1;
+    }
+};
+
+#endif
@@ -7,11 +7,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "predictor.h"
+#include "trace.h"
+#include "sweep.h"
+#include "target.h"
+#include "pipeline.h"
+#include "snapshot.h"
+#include "simpoint.h"
 
-FILE *stream;
-char *buf = NULL;
-size_t len = 0;
+trace_reader trace;
+int numThreads;
+target_config targetConfig; // Target predictor, type TARGET_NONE if off
+ras_config rasConfig;       // Return address stack, depth 0 if off
+btb_config btbConfig;       // Branch target buffer, 0 entries if off
+pipeline_config pipelineConfig; // Delayed updates, depth -1 if off
+int budgetPolicy = BUDGET_WARN;   // BUDGET_*
+int printBudget;
+const char *snapshotPath;   // Snapshot to save after snapshotAt records
+uint64_t snapshotAt;
+const char *resumePath;     // Snapshot to resume from
+
+// Records are skipped, then only train the predictor, then are measured,
+// in turn; a measure of 0 runs to the end of the trace
+#define REGION_SKIP 0
+#define REGION_WARM 1
+#define REGION_MEASURE 2
+int useRegions;
+uint64_t regionLength[3];
+
+// Intervals simulated in place of the whole trace, each after a warmup
+simpoint_set simpoints;     // No points if off
+uint64_t simpointWarm;
+int simpointCheck;          // Also simulate the whole trace for reference
 
 // Print out the Usage information to stderr
 //
@@ -19,14 +47,185 @@ void usage()
 {
   fprintf(stderr, "Usage: predictor <options> [<trace>]\n");
   fprintf(stderr, "       bunzip2 -kc trace.bz2 | predictor <options>\n");
+  fprintf(stderr, " Text and binary traces (see convert_trace) are detected automatically,\n");
+  fprintf(stderr, " bzip2 compressed ones when given by path\n");
   fprintf(stderr, " Options:\n");
   fprintf(stderr, " --help       Print this message\n");
   fprintf(stderr, " --verbose    Print predictions on stdout\n");
+  fprintf(stderr, " --threads=<n> Worker threads for bzip2 decompression and sweeps;\n"
+                  "              1 also decodes the trace on the simulation thread\n");
   fprintf(stderr, " --<type>     Branch prediction scheme:\n");
   fprintf(stderr, "    static\n"
-                  "    gshare\n"
-                  "    tournament\n"
-                  "    custom\n");
+                  "    gshare[:<ghist>]\n"
+                  "    tournament[:<ghist>[:<lhist>[:<pcindex>]]]\n"
+                  "    custom\n"
+                  "    perceptron[:<hist>[:<tables>]]\n"
+                  "    tagescl[:<tables>[:<minhist>[:<maxhist>]]]\n");
+  fprintf(stderr, " --sweep=<list> Simulate a comma-separated list of schemes in one\n"
+                  "              pass over the trace; sizes may be ranges, as in\n"
+                  "              gshare:8-20, and @<file> reads the list from a file\n");
+  fprintf(stderr, " --target=<type> Also predict the targets of indirect jumps and calls:\n"
+                  "    btb[:<log2 entries>]\n"
+                  "    ittage[:<tables>[:<minhist>[:<maxhist>]]]\n");
+  fprintf(stderr, " --ras=<depth>[:<overflow>[:<repair>[:<wrongpath>]]]\n"
+                  "              Also predict return targets with a return address\n"
+                  "              stack; overflow is wrap or drop, repair after the\n"
+                  "              wrong path of a misprediction is none, tos, top or\n"
+                  "              full, and the wrong path replays the calls and\n"
+                  "              returns of the last <wrongpath> records\n");
+  fprintf(stderr, " --btb=<entries>[:<ways>[:<tagbits>[:<policy>]]]\n"
+                  "              Also look up the targets of taken branches in a\n"
+                  "              branch target buffer; policy is lru, srrip or random\n");
+  fprintf(stderr, " --budget     Print the storage of every predictor structure\n");
+  fprintf(stderr, " --budget=<policy> Configurations over the 64Kbit + 1024 bit budget\n"
+                  "              are allowed (off), warned about (warn, the default),\n"
+                  "              or refused and left out of sweeps (enforce)\n");
+  fprintf(stderr, " --delay=<n>[:<repair>]\n"
+                  "              Train conditional branches <n> branches after their\n"
+                  "              prediction; repair is repair (history holds actual\n"
+                  "              outcomes), norepair (predicted outcomes) or\n"
+                  "              checkpoint (predicted outcomes until a mispredicted\n"
+                  "              branch resolves, restores the history and fetches\n"
+                  "              the younger branches again; <n> below 256)\n");
+  fprintf(stderr, " --snapshot=<n>:<file> Save the predictor state to <file> after <n>\n"
+                  "              records of the trace\n");
+  fprintf(stderr, " --resume=<file> Continue the run a snapshot was saved from, with its\n"
+                  "              predictor configuration and state\n");
+  fprintf(stderr, " --regions=<skip>:<warm>[:<measure>]\n"
+                  "              Skip <skip> records, train on <warm> records without\n"
+                  "              scoring them, then score <measure> records, repeating\n"
+                  "              over the trace; without <measure> the first region\n"
+                  "              is scored to the end\n");
+  fprintf(stderr, " --simpoints=<file>[:<warm>]\n"
+                  "              Simulate only the intervals pick_simpoints chose,\n"
+                  "              each after training on the <warm> records before\n"
+                  "              it (default one interval), and weigh their rates\n");
+  fprintf(stderr, " --simpoint-check Also simulate the whole trace and print the error\n"
+                  "              of the weighted rate\n");
+  fprintf(stderr, " --prefetch=<n> Prefetch the table entries of the branch <n> records\n"
+                  "              ahead of the one simulated, 0 for none (default 16)\n");
+}
+
+// Parse "<skip>:<warm>[:<measure>]" into regionLength
+//
+// Returns True if Successful
+//
+static int parse_regions(const char *spec)
+{
+  regionLength[REGION_MEASURE] = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    char *end;
+    regionLength[i] = strtoull(spec, &end, 10);
+    if (end == spec || *spec == '-')
+      return 0;
+    if (*end == '\0')
+      return i >= REGION_WARM;
+    if (*end != ':')
+      return 0;
+    spec = end + 1;
+  }
+  return 0;
+}
+
+// Parse "<file>[:<warm>]" and read the simpoints of <file>
+//
+// Returns True if Successful
+//
+static int parse_simpoints(const char *spec)
+{
+  char path[4096];
+  const char *colon = strrchr(spec, ':');
+  char *end = NULL;
+  if (colon != NULL)
+    simpointWarm = strtoull(colon + 1, &end, 10);
+  if (colon == NULL || end == colon + 1 || *end != '\0')
+  {
+    colon = spec + strlen(spec);
+    simpointWarm = UINT64_MAX;
+  }
+  if (colon == spec || colon - spec >= (int)sizeof(path))
+    return 0;
+  memcpy(path, spec, colon - spec);
+  path[colon - spec] = '\0';
+
+  free_simpoints(&simpoints);
+  if (!read_simpoints(path, &simpoints))
+    return 0;
+  if (simpointWarm == UINT64_MAX)
+    simpointWarm = simpoints.intervalRecords;
+  return 1;
+}
+
+// The region record 'r' of the trace falls in
+//
+// Returns the region, with the records left in it from 'r' on in 'left'
+// and, for a measured simpoint, its index in 'point'
+//
+static int region_of(uint64_t r, uint64_t *left, int *point)
+{
+  *left = UINT64_MAX;
+  if (simpoints.numPoints > 0)
+  {
+    // The first simpoint not over by record 'r', and the warmup before it
+    for (int p = 0; p < simpoints.numPoints; p++)
+    {
+      uint64_t start = simpoints.points[p].interval * simpoints.intervalRecords;
+      uint64_t end = start + simpoints.intervalRecords;
+      uint64_t warmStart = (start > simpointWarm) ? start - simpointWarm : 0;
+      if (r >= end)
+        continue;
+      if (r >= start)
+      {
+        *left = end - r;
+        *point = p;
+        return REGION_MEASURE;
+      }
+      if (r >= warmStart)
+      {
+        *left = start - r;
+        return REGION_WARM;
+      }
+      *left = warmStart - r;
+      return REGION_SKIP;
+    }
+    return REGION_SKIP;
+  }
+  if (!useRegions)
+    return REGION_MEASURE;
+
+  uint64_t period = regionLength[REGION_SKIP] + regionLength[REGION_WARM] + regionLength[REGION_MEASURE];
+  uint64_t phase = (regionLength[REGION_MEASURE] == 0) ? r : r % period;
+  for (int i = REGION_SKIP; i < REGION_MEASURE; i++)
+  {
+    if (phase < regionLength[i])
+    {
+      *left = regionLength[i] - phase;
+      return i;
+    }
+    phase -= regionLength[i];
+  }
+  if (regionLength[REGION_MEASURE] != 0)
+    *left = regionLength[REGION_MEASURE] - phase;
+  return REGION_MEASURE;
+}
+
+// Number of the first 'records' records of the trace in measured regions
+//
+static uint64_t measured_before(uint64_t records)
+{
+  uint64_t measured = 0;
+  uint64_t left;
+  int point;
+  for (uint64_t r = 0; r < records; r += left)
+  {
+    int region = region_of(r, &left, &point);
+    if (left > records - r)
+      left = records - r;
+    if (region == REGION_MEASURE)
+      measured += left;
+  }
+  return measured;
 }
 
 // Process an option and update the predictor
@@ -36,26 +235,86 @@ void usage()
 //
 int handle_option(char *arg)
 {
-  if (!strcmp(arg, "--static"))
+  predictor_config cfg;
+
+  if (parse_config(arg + 2, &cfg, 1) == 1)
+  {
+    set_predictor_config(&cfg);
+  }
+  else if (!strncmp(arg, "--sweep=", 8))
+  {
+    return sweep_add(arg + 8);
+  }
+  else if (!strncmp(arg, "--target=", 9))
+  {
+    return parse_target_config(arg + 9, &targetConfig);
+  }
+  else if (!strncmp(arg, "--ras=", 6))
+  {
+    return parse_ras_config(arg + 6, &rasConfig);
+  }
+  else if (!strncmp(arg, "--btb=", 6))
+  {
+    return parse_btb_config(arg + 6, &btbConfig);
+  }
+  else if (!strncmp(arg, "--delay=", 8))
   {
-    bpType = STATIC;
+    return parse_pipeline_config(arg + 8, &pipelineConfig);
   }
-  else if (!strncmp(arg, "--gshare", 8))
+  else if (!strncmp(arg, "--snapshot=", 11))
   {
-    bpType = GSHARE;
+    return parse_snapshot_option(arg + 11, &snapshotAt, &snapshotPath);
   }
-  else if (!strncmp(arg, "--tournament", 12))
+  else if (!strncmp(arg, "--resume=", 9))
   {
-    bpType = TOURNAMENT;
+    resumePath = arg + 9;
+    return *resumePath != '\0';
   }
-  else if (!strncmp(arg, "--custom", 8))
+  else if (!strncmp(arg, "--regions=", 10))
   {
-    bpType = CUSTOM;
+    useRegions = 1;
+    return parse_regions(arg + 10);
+  }
+  else if (!strncmp(arg, "--simpoints=", 12))
+  {
+    return parse_simpoints(arg + 12);
+  }
+  else if (!strcmp(arg, "--simpoint-check"))
+  {
+    simpointCheck = 1;
+  }
+  else if (!strncmp(arg, "--prefetch=", 11))
+  {
+    char *end;
+    prefetchDistance = strtol(arg + 11, &end, 10);
+    return end != arg + 11 && *end == '\0' && prefetchDistance >= 0;
+  }
+  else if (!strcmp(arg, "--budget"))
+  {
+    printBudget = 1;
+  }
+  else if (!strncmp(arg, "--budget=", 9))
+  {
+    static const char *policies[] = {"off", "warn", "enforce"};
+    for (int i = 0; i < 3; i++)
+    {
+      if (!strcmp(arg + 9, policies[i]))
+      {
+        budgetPolicy = i;
+        return 1;
+      }
+    }
+    return 0;
   }
   else if (!strcmp(arg, "--verbose"))
   {
     verbose = 1;
   }
+  else if (!strncmp(arg, "--threads=", 10))
+  {
+    numThreads = atoi(arg + 10);
+    return numThreads > 0;
+  }
   else
   {
     return 0;
@@ -64,29 +323,71 @@ int handle_option(char *arg)
   return 1;
 }
 
-// Reads a line from the input stream and extracts the
+// Reads a record from the input stream and extracts the
 // PC and Outcome of a branch
 //
 // Returns True if Successful
 //
 int read_branch(uint32_t *pc, uint32_t *target, uint32_t *outcome, uint32_t *condition, uint32_t *call, uint32_t *ret, uint32_t *direct)
 {
-  if (getline(&buf, &len, stream) == -1)
+  branch_record r;
+  if (!trace_next(&trace, &r))
   {
     return 0;
   }
 
-  sscanf(buf, "0x%x\t0x%x\t%d\t%d\t%d\t%d\t%d\n", pc, target, outcome, condition, call, ret, direct);
-
+  *pc = r.pc;
+  *target = r.target;
+  *outcome = r.outcome;
+  *condition = r.condition;
+  *call = r.call;
+  *ret = r.ret;
+  *direct = r.direct;
   return 1;
 }
 
+// Score the prediction of a resolved conditional branch; a misprediction
+// also sends the return stack down the wrong path
+//
+static void score_branch(uint32_t prediction, uint32_t outcome, uint32_t *mispredictions, ReturnStack *ras)
+{
+  if (prediction != outcome)
+  {
+    (*mispredictions)++;
+    if (ras != NULL)
+      ras->mispredict();
+  }
+  if (verbose != 0)
+  {
+    printf("%d\n", prediction);
+  }
+}
+
+// Predict and train 'n' records at once, scoring the conditional branches
+//
+static void run_records(const branch_record *recs, size_t n, uint32_t *num_branches, uint32_t *mispredictions)
+{
+  uint8_t predictions[TRACE_BATCH];
+  *mispredictions += predict_batch(recs, n, predictions);
+  for (size_t k = 0; k < n; k++)
+  {
+    if (recs[k].condition == 1)
+    {
+      (*num_branches)++;
+      if (verbose != 0)
+        printf("%d\n", predictions[k]);
+    }
+  }
+}
+
 int main(int argc, char *argv[])
 {
   // Set defaults
-  stream = stdin;
+  const char *trace_path = NULL;
   bpType = STATIC;
   verbose = 0;
+  numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  pipelineConfig.depth = -1;
 
   // Process cmdline Arguments
   for (int i = 1; i < argc; ++i)
@@ -108,15 +409,124 @@ int main(int argc, char *argv[])
     else
     {
       // Use as input file
-      stream = fopen(argv[i], "r");
+      trace_path = argv[i];
+    }
+  }
+
+  // Open the trace, memory-mapping it when a file is given
+  if (!trace_open(&trace, trace_path, numThreads))
+  {
+    exit(1);
+  }
+
+  if (sweep_size() > 0)
+  {
+    if (verbose || targetConfig.type != TARGET_NONE || rasConfig.depth > 0 || btbConfig.entries > 0 ||
+        pipelineConfig.depth >= 0 || printBudget || snapshotPath != NULL || resumePath != NULL || useRegions ||
+        simpoints.numPoints > 0)
+    {
+      fprintf(stderr, "--verbose, --target, --ras, --btb, --delay, --budget, --snapshot, --resume, "
+                      "--regions and --simpoints are not supported with --sweep\n");
+      exit(1);
+    }
+    if (sweep_check_budget(budgetPolicy) == 0)
+    {
+      fprintf(stderr, "No configuration of the sweep fits the budget\n");
+      exit(1);
     }
+    sweep_run(&trace, numThreads);
+    trace_close(&trace);
+    return 0;
+  }
+
+  // Decode the trace on a thread of its own, overlapping the simulation;
+  // the trace is decoded inline if the thread cannot be started
+  if (numThreads > 1)
+  {
+    trace_start_decoder(&trace);
+  }
+
+  // Snapshots, regions and simpoints drive the conditional branch
+  // predictor alone
+  if ((snapshotPath != NULL || resumePath != NULL || useRegions || simpoints.numPoints > 0) &&
+      (targetConfig.type != TARGET_NONE || rasConfig.depth > 0 || btbConfig.entries > 0 || pipelineConfig.depth >= 0))
+  {
+    fprintf(stderr, "--target, --ras, --btb and --delay are not supported with --snapshot, --resume, "
+                    "--regions and --simpoints\n");
+    exit(1);
+  }
+  if (simpoints.numPoints > 0 && (snapshotPath != NULL || resumePath != NULL || useRegions))
+  {
+    fprintf(stderr, "--snapshot, --resume and --regions are not supported with --simpoints\n");
+    exit(1);
+  }
+  if (simpointCheck && simpoints.numPoints == 0)
+  {
+    fprintf(stderr, "--simpoint-check needs --simpoints\n");
+    exit(1);
+  }
+
+  // A resumed run takes its configuration and state from the snapshot
+  snapshot_header snap;
+  if (resumePath != NULL)
+  {
+    if (!load_snapshot(resumePath, &snap))
+    {
+      exit(1);
+    }
+    if (snap.traceRecords != 0 && trace.num_records != 0 && snap.traceRecords != trace.num_records)
+    {
+      fprintf(stderr, "%s: Saved from a trace of %llu records, not %llu\n", resumePath,
+              (unsigned long long)snap.traceRecords, (unsigned long long)trace.num_records);
+      exit(1);
+    }
+    if (snapshotPath != NULL && snapshotAt < snap.records)
+    {
+      fprintf(stderr, "--snapshot=%llu is before the %llu records %s resumes from\n", (unsigned long long)snapshotAt,
+              (unsigned long long)snap.records, resumePath);
+      exit(1);
+    }
+  }
+
+  // Check the configuration against the hardware budget
+  predictor_config cfg;
+  get_predictor_config(&cfg);
+  predictor_budget budget;
+  get_config_budget(&cfg, &budget);
+  if (budgetPolicy != BUDGET_OFF && !budget_fits(&budget))
+  {
+    fprintf(stderr, "%s: %s uses %llu table bits and %llu register bits, over the %d + %d bit budget\n",
+            (budgetPolicy == BUDGET_ENFORCE) ? "Error" : "Warning", bpName[bpType],
+            (unsigned long long)budget.tableBits, (unsigned long long)budget.registerBits,
+            BUDGET_TABLE_BITS, BUDGET_REGISTER_BITS);
+    if (budgetPolicy == BUDGET_ENFORCE)
+      exit(1);
   }
 
   // Initialize the predictor
-  init_predictor();
+  if (resumePath == NULL)
+    init_predictor();
+  TargetPredictor *targetPredictor = create_target_predictor(&targetConfig);
+  ReturnStack *ras = (rasConfig.depth > 0) ? new ReturnStack(&rasConfig) : NULL;
+  BranchTargetBuffer *btb = (btbConfig.entries > 0) ? new BranchTargetBuffer(&btbConfig) : NULL;
+
+  // Delayed updates drive the predictor through the pipeline instead
+  BranchPipeline *pipeline = NULL;
+  if (pipelineConfig.depth >= 0)
+    pipeline = new BranchPipeline(get_active_predictor(), &pipelineConfig);
 
+  uint32_t num_records = 0;
+  uint64_t measured_records = 0;
+  uint32_t *pointBranches = (uint32_t *)calloc(simpoints.numPoints + 1, sizeof(uint32_t));
+  uint32_t *pointMispredictions = (uint32_t *)calloc(simpoints.numPoints + 1, sizeof(uint32_t));
   uint32_t num_branches = 0;
   uint32_t mispredictions = 0;
+  uint32_t num_indirect = 0;
+  uint32_t target_mispredictions = 0;
+  uint32_t num_returns = 0;
+  uint32_t return_mispredictions = 0;
+  uint32_t btb_lookups = 0;
+  uint32_t btb_misses = 0;
   uint32_t pc = 0;
   uint32_t target = 0;
   uint32_t outcome = NOTTAKEN;
@@ -125,36 +535,237 @@ int main(int argc, char *argv[])
   uint32_t ret = 0;
   uint32_t direct = 0;
 
+  // Counts carry on from the snapshot, past the records it covers
+  uint64_t skip = 0;
+  if (resumePath != NULL)
+  {
+    skip = snap.records;
+    num_records = snap.records;
+    measured_records = measured_before(snap.records);
+    num_branches = snap.branches;
+    mispredictions = snap.mispredictions;
+  }
+
+  // With nothing else to drive, whole batches of the trace run through
+  // the predictor at once
+  int batched = (targetPredictor == NULL && ras == NULL && btb == NULL && pipeline == NULL);
+
+  // The simpoint check runs the whole trace through a predictor of its own
+  Predictor *full = simpointCheck ? create_predictor(&cfg) : NULL;
+  uint32_t full_branches = 0;
+  uint32_t full_mispredictions = 0;
+  if (batched)
+  {
+    int done = 0;
+    while (!done && trace_fill(&trace) > 0)
+    {
+      if (full != NULL)
+      {
+        full_mispredictions += full->run_batch(trace.recs, trace.count, prefetchDistance, NULL);
+        for (size_t k = 0; k < trace.count; k++)
+          full_branches += (trace.recs[k].condition == 1);
+      }
+
+      size_t k = (skip < trace.count) ? skip : trace.count;
+      skip -= k;
+      while (k < trace.count)
+      {
+        // Stop at the end of the region and at the snapshot, within the
+        // batch if need be
+        uint64_t left;
+        int point = 0;
+        int region = region_of(num_records, &left, &point);
+        if (region == REGION_SKIP && left == UINT64_MAX && full == NULL && snapshotPath == NULL)
+        {
+          // Nothing left to simulate
+          done = 1;
+          break;
+        }
+        size_t n = trace.count - k;
+        if (left < n)
+          n = left;
+        if (snapshotPath != NULL && snapshotAt - num_records < n)
+          n = snapshotAt - num_records;
+
+        if (region == REGION_MEASURE && simpoints.numPoints > 0)
+        {
+          run_records(trace.recs + k, n, &pointBranches[point], &pointMispredictions[point]);
+          measured_records += n;
+        }
+        else if (region == REGION_MEASURE)
+        {
+          run_records(trace.recs + k, n, &num_branches, &mispredictions);
+          measured_records += n;
+        }
+        else if (region == REGION_WARM)
+        {
+          train_batch(trace.recs + k, n);
+        }
+        k += n;
+        num_records += n;
+
+        if (snapshotPath != NULL && num_records == snapshotAt)
+        {
+          snapshot_header h = {cfg, num_records, trace.num_records, num_branches, mispredictions};
+          if (!save_snapshot(snapshotPath, &h))
+          {
+            exit(1);
+          }
+          snapshotPath = NULL;
+        }
+      }
+    }
+    if (skip > 0)
+    {
+      fprintf(stderr, "%s: The trace ends before the %llu records it covers\n", resumePath,
+              (unsigned long long)snap.records);
+      exit(1);
+    }
+    if (snapshotPath != NULL)
+    {
+      fprintf(stderr, "Warning: the trace ends before record %llu, no snapshot saved\n",
+              (unsigned long long)snapshotAt);
+    }
+  }
+
   // Reach each branch from the trace
-  while (read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct))
+  while (!batched && read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct))
   {
     if (condition == 1)
     {
       num_branches++;
-      // Make a prediction and compare with actual outcome
-      uint32_t prediction = make_prediction(pc, target, direct);
-      if (prediction != outcome)
+      if (pipeline != NULL)
       {
-        mispredictions++;
+        // Branches in flight are scored as they resolve
+        uint32_t prediction, resolved;
+        pipeline->fetch(pc, outcome);
+        while (pipeline->resolve(0, &prediction, &resolved))
+          score_branch(prediction, resolved, &mispredictions, ras);
       }
-      if (verbose != 0)
+      else
       {
-        printf("%d\n", prediction);
+        // Make a prediction and compare with actual outcome
+        score_branch(make_prediction(pc, target, direct), outcome, &mispredictions, ras);
       }
     }
-    // Train the predictor
-    train_predictor(pc, target, outcome, condition, call, ret, direct);
+    // Train the predictor, unless the pipeline trains it later
+    if (pipeline == NULL)
+      train_predictor(pc, target, outcome, condition, call, ret, direct);
+
+    // Score and train the target predictor on indirect jumps and calls
+    num_records++;
+    if (targetPredictor != NULL)
+    {
+      if (target_scored(ret, direct))
+      {
+        num_indirect++;
+        if (targetPredictor->predict(pc) != target)
+          target_mispredictions++;
+      }
+      targetPredictor->train(pc, target, outcome, condition, call, ret, direct);
+    }
+
+    // Score returns against the return address stack
+    if (ras != NULL)
+    {
+      if (ret)
+      {
+        num_returns++;
+        if (!ras->predict(target))
+          return_mispredictions++;
+      }
+      ras->train(pc, call, ret);
+    }
+
+    // Taken branches of every kind redirect fetch through the BTB
+    if (btb != NULL && (outcome == TAKEN || !condition))
+    {
+      btb_lookups++;
+      if (!btb->access(pc, target, ret))
+        btb_misses++;
+    }
+  }
+
+  uint64_t refetches = 0;
+  if (pipeline != NULL)
+  {
+    uint32_t prediction, resolved;
+    while (pipeline->resolve(1, &prediction, &resolved))
+      score_branch(prediction, resolved, &mispredictions, ras);
+    refetches = pipeline->refetches;
+    delete pipeline;
   }
 
+  // Each simpoint stands for the share of the trace its weight gives, so
+  // its branches and mispredictions are weighed before the rate is taken;
+  // intervals hold as many records but not as many conditional branches
+  double weighted_branches = 0;
+  double weighted_mispredictions = 0;
+  for (int p = 0; p < simpoints.numPoints; p++)
+  {
+    num_branches += pointBranches[p];
+    mispredictions += pointMispredictions[p];
+    weighted_branches += simpoints.points[p].weight * pointBranches[p];
+    weighted_mispredictions += simpoints.points[p].weight * pointMispredictions[p];
+  }
+  free(pointBranches);
+  free(pointMispredictions);
+
   // Print out the mispredict statistics
   printf("Branches:        %10d\n", num_branches);
   printf("Incorrect:       %10d\n", mispredictions);
   float mispredict_rate = 1000 * ((float)mispredictions / (float)num_branches);
   printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  if (pipelineConfig.repair == PIPELINE_CHECKPOINT)
+    printf("Refetched:       %10llu\n", (unsigned long long)refetches);
+  if (useRegions || simpoints.numPoints > 0)
+    printf("Measured:        %10llu\n", (unsigned long long)measured_records);
+  double weighted_rate = (weighted_branches > 0) ? 1000 * weighted_mispredictions / weighted_branches : 0;
+  if (simpoints.numPoints > 0)
+  {
+    printf("Simpoints:       %10d\n", simpoints.numPoints);
+    printf("Weighted Rate:      %7.3f\n", weighted_rate);
+  }
+  if (full != NULL)
+  {
+    double full_rate = 1000 * ((double)full_mispredictions / full_branches);
+    printf("Full Rate:          %7.3f\n", full_rate);
+    printf("Estimate Error:     %7.2f%%\n", 100 * (weighted_rate - full_rate) / full_rate);
+    delete full;
+  }
+
+  // Traces carry no instruction counts, so target mispredictions are
+  // per thousand records (branches of any kind) of the trace
+  if (targetPredictor != NULL)
+  {
+    printf("Indirect:        %10d\n", num_indirect);
+    printf("Target Incorrect:%10d\n", target_mispredictions);
+    printf("Target MPKB:        %7.3f\n", 1000 * ((float)target_mispredictions / (float)num_records));
+    delete targetPredictor;
+  }
+  if (ras != NULL)
+  {
+    printf("Returns:         %10d\n", num_returns);
+    printf("Return Incorrect:%10d\n", return_mispredictions);
+    printf("Return Accuracy:    %7.3f\n", 100 * (1 - (float)return_mispredictions / (float)num_returns));
+    delete ras;
+  }
+  if (btb != NULL)
+  {
+    printf("BTB Lookups:     %10d\n", btb_lookups);
+    printf("BTB Misses:      %10d\n", btb_misses);
+    printf("BTB MPKB:           %7.3f\n", 1000 * ((float)btb_misses / (float)num_records));
+    delete btb;
+  }
+
+  if (printBudget)
+  {
+    get_predictor_budget(&budget);
+    print_budget(&budget);
+  }
 
   // Cleanup
-  fclose(stream);
-  free(buf);
+  trace_close(&trace);
 
   return 0;
 }
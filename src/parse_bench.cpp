@@ -0,0 +1,216 @@
+//========================================================//
+//  parse_bench.cpp                                       //
+//  Micro-benchmark for the text trace parsers            //
+//                                                        //
+//  Times getline-style sscanf parsing against each text  //
+//  parser supported on this machine and checks that      //
+//  they decode every record identically                  //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+// Print out the Usage information to stderr
+//
+void usage()
+{
+  fprintf(stderr, "Usage: parse_bench <trace> [<repeats>]\n");
+  fprintf(stderr, " <trace>   text trace, plain or bzip2 compressed\n");
+  fprintf(stderr, " <repeats> timed passes per parser, best is reported (default 3)\n");
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Load the whole decompressed trace, padded so no parser reads past it
+//
+char *load_trace(const char *path, size_t *len)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    return NULL;
+  }
+  const uint8_t *map = (const uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    return NULL;
+  }
+
+  char *text = NULL;
+  size_t cap = 0;
+  *len = 0;
+  bz2_decoder *bz2 = bz2_is_compressed(map, st.st_size)
+                         ? bz2_open(map, st.st_size, sysconf(_SC_NPROCESSORS_ONLN))
+                         : NULL;
+  const uint8_t *chunk = map;
+  size_t chunk_len = st.st_size;
+  int more = 1;
+  while (more)
+  {
+    if (bz2 != NULL && bz2_next(bz2, &chunk, &chunk_len) <= 0)
+    {
+      break;
+    }
+    if (*len + chunk_len + 1 > cap)
+    {
+      cap = 2 * (*len + chunk_len + 1);
+      text = (char *)realloc(text, cap);
+    }
+    memcpy(text + *len, chunk, chunk_len);
+    *len += chunk_len;
+    more = (bz2 != NULL);
+  }
+  if (bz2 != NULL)
+  {
+    bz2_close(bz2);
+  }
+  munmap((void *)map, st.st_size);
+
+  text = (char *)realloc(text, *len + 128);
+  memset(text + *len, 0, 128);
+  return text;
+}
+
+// Parse every line the way read_branch originally did: copy the line out
+// like getline, then sscanf it
+//
+size_t parse_sscanf(const char *text, size_t len, branch_record *recs)
+{
+  char line[256];
+  const char *p = text;
+  const char *end = text + len;
+  size_t n = 0;
+  while (p < end)
+  {
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    size_t l = (nl ? nl + 1 : end) - p;
+    if (l >= sizeof(line))
+      l = sizeof(line) - 1;
+    memcpy(line, p, l);
+    line[l] = 0;
+    p = nl ? nl + 1 : end;
+
+    uint32_t outcome, condition, call, ret, direct;
+    branch_record *r = &recs[n];
+    if (sscanf(line, "0x%x\t0x%x\t%d\t%d\t%d\t%d\t%d\n", &r->pc, &r->target,
+               &outcome, &condition, &call, &ret, &direct) == 7)
+    {
+      r->outcome = outcome;
+      r->condition = condition;
+      r->call = call;
+      r->ret = ret;
+      r->direct = direct;
+      n++;
+    }
+  }
+  return n;
+}
+
+size_t parse_selected(const char *text, size_t len, branch_record *recs)
+{
+  const char *p = text;
+  const char *end = text + len;
+  size_t n = 0;
+  while (p < end)
+  {
+    int ok;
+    p = trace_parse_text(p, end, &recs[n], &ok);
+    n += ok;
+  }
+  return n;
+}
+
+static int same_record(const branch_record *a, const branch_record *b)
+{
+  return a->pc == b->pc && a->target == b->target && a->outcome == b->outcome &&
+         a->condition == b->condition && a->call == b->call && a->ret == b->ret &&
+         a->direct == b->direct;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2 || argc > 3 || !strcmp(argv[1], "--help"))
+  {
+    usage();
+    exit(argc < 2 || argc > 3);
+  }
+  int repeats = (argc > 2) ? atoi(argv[2]) : 3;
+  if (repeats < 1)
+  {
+    repeats = 1;
+  }
+
+  size_t len;
+  char *text = load_trace(argv[1], &len);
+  if (text == NULL)
+  {
+    fprintf(stderr, "Error: cannot load %s\n", argv[1]);
+    exit(1);
+  }
+  size_t lines = 0;
+  for (const char *p = text; (p = (const char *)memchr(p, '\n', text + len - p)) != NULL; p++)
+  {
+    lines++;
+  }
+
+  // One extra slot for a final line without newline
+  branch_record *ref = (branch_record *)malloc((lines + 1) * sizeof(branch_record));
+  branch_record *recs = (branch_record *)malloc((lines + 1) * sizeof(branch_record));
+
+  printf("Trace: %s (%zu lines, %.1f MB)\n", argv[1], lines, len / 1e6);
+  printf("Parser        Records     Seconds       Records/s  Mismatches\n");
+
+  double t0 = now();
+  size_t num_ref = parse_sscanf(text, len, ref);
+  double secs = now() - t0;
+  printf("%-8s %12zu %11.3f %15.0f %11s\n", "sscanf", num_ref, secs, num_ref / secs, "-");
+
+  int failed = 0;
+  for (int kind = PARSE_SCALAR; kind <= PARSE_AVX2; kind++)
+  {
+    if (!trace_select_parser(kind))
+    {
+      printf("%-8s %12s\n", parserName[kind], "unsupported");
+      continue;
+    }
+
+    double best = 0;
+    size_t n = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+      t0 = now();
+      n = parse_selected(text, len, recs);
+      secs = now() - t0;
+      if (r == 0 || secs < best)
+        best = secs;
+    }
+
+    size_t mismatches = (n > num_ref) ? n - num_ref : num_ref - n;
+    for (size_t i = 0; i < n && i < num_ref; i++)
+    {
+      mismatches += !same_record(&ref[i], &recs[i]);
+    }
+    failed |= (mismatches != 0);
+    printf("%-8s %12zu %11.3f %15.0f %11zu\n", parserName[kind], n, best, n / best, mismatches);
+  }
+
+  free(ref);
+  free(recs);
+  free(text);
+
+  return failed;
+}
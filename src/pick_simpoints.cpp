@@ -0,0 +1,500 @@
+//========================================================//
+//  pick_simpoints.cpp                                    //
+//  Picks representative intervals of a branch trace      //
+//                                                        //
+//  Each interval is summarized by how often each branch  //
+//  PC occurs in it, randomly projected to a few          //
+//  dimensions; the vectors are clustered with k-means    //
+//  and the interval nearest each centroid stands for     //
+//  its cluster, see simpoint.h                           //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "trace.h"
+#include "simpoint.h"
+
+#define MAX_DIMS 64
+#define KMEANS_RESTARTS 5    // Seeds tried per k, the best is kept
+#define KMEANS_MAX_ITERS 100
+#define BIC_THRESHOLD 0.9    // Smallest k scoring this share of the best
+
+// Print out the Usage information to stderr
+//
+void usage()
+{
+  fprintf(stderr, "Usage: pick_simpoints <options> <trace> <simpoints>\n");
+  fprintf(stderr, " <trace>     trace, text, binary or bzip2 compressed\n");
+  fprintf(stderr, " <simpoints> file the representative intervals are written to\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --interval=<n> Records per interval (default 100000)\n");
+  fprintf(stderr, " --maxk=<n>     Most clusters tried (default 10)\n");
+  fprintf(stderr, " --dims=<n>     Dimensions of the projected vectors (default 15)\n");
+  fprintf(stderr, " --seed=<n>     Seed of the projection and of k-means (default 1)\n");
+}
+
+static uint64_t splitmix64(uint64_t x)
+{
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+// Uniform in [0, 1), advancing 'state'
+static double random_unit(uint64_t *state)
+{
+  *state = splitmix64(*state);
+  return (*state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+//------------------------------------//
+//       Interval PC Vectors          //
+//------------------------------------//
+
+// The distinct PCs seen so far, each with its projection row and its
+// count in the current interval
+typedef struct
+{
+  uint32_t *keys;    // Open addressing, slot + 1 or 0 if empty
+  uint32_t *pcs;
+  int capacity;      // Power of two
+  int numPcs;
+  float *rows;       // numPcs x dims, uniform in [-1, 1)
+  uint32_t *counts;
+  int *touched;      // PCs counted in the current interval
+  int numTouched;
+  int dims;
+  uint64_t seed;
+} pc_table;
+
+static void pc_table_init(pc_table *t, int dims, uint64_t seed)
+{
+  memset(t, 0, sizeof(*t));
+  t->capacity = 1024;
+  t->keys = (uint32_t *)calloc(t->capacity, sizeof(uint32_t));
+  t->dims = dims;
+  t->seed = seed;
+}
+
+static void pc_table_free(pc_table *t)
+{
+  free(t->keys);
+  free(t->pcs);
+  free(t->rows);
+  free(t->counts);
+  free(t->touched);
+}
+
+static inline uint32_t pc_hash(uint32_t pc)
+{
+  return (uint32_t)((pc * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static void pc_table_grow(pc_table *t)
+{
+  int capacity = 2 * t->capacity;
+  uint32_t *keys = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+  for (int i = 0; i < t->numPcs; i++)
+  {
+    uint32_t h = pc_hash(t->pcs[i]) & (capacity - 1);
+    while (keys[h] != 0)
+      h = (h + 1) & (capacity - 1);
+    keys[h] = i + 1;
+  }
+  free(t->keys);
+  t->keys = keys;
+  t->capacity = capacity;
+
+  t->pcs = (uint32_t *)realloc(t->pcs, capacity * sizeof(uint32_t));
+  t->rows = (float *)realloc(t->rows, (size_t)capacity * t->dims * sizeof(float));
+  t->counts = (uint32_t *)realloc(t->counts, capacity * sizeof(uint32_t));
+  t->touched = (int *)realloc(t->touched, capacity * sizeof(int));
+}
+
+// Count one occurrence of 'pc' in the current interval
+static void pc_table_count(pc_table *t, uint32_t pc)
+{
+  uint32_t h = pc_hash(pc) & (t->capacity - 1);
+  while (t->keys[h] != 0)
+  {
+    int i = t->keys[h] - 1;
+    if (t->pcs[i] == pc)
+    {
+      if (t->counts[i]++ == 0)
+        t->touched[t->numTouched++] = i;
+      return;
+    }
+    h = (h + 1) & (t->capacity - 1);
+  }
+
+  // A new PC; its row depends only on the PC and the seed
+  if (2 * (t->numPcs + 1) > t->capacity || t->pcs == NULL)
+  {
+    pc_table_grow(t);
+    pc_table_count(t, pc);
+    return;
+  }
+  int i = t->numPcs++;
+  t->keys[h] = i + 1;
+  t->pcs[i] = pc;
+  uint64_t state = splitmix64(pc ^ (t->seed << 32));
+  for (int d = 0; d < t->dims; d++)
+    t->rows[(size_t)i * t->dims + d] = (float)(2 * random_unit(&state) - 1);
+  t->counts[i] = 1;
+  t->touched[t->numTouched++] = i;
+}
+
+// Project the PC frequencies of the current interval of 'records'
+// records into 'vec', then start the next interval
+static void pc_table_project(pc_table *t, uint64_t records, double *vec)
+{
+  for (int d = 0; d < t->dims; d++)
+    vec[d] = 0;
+  for (int k = 0; k < t->numTouched; k++)
+  {
+    int i = t->touched[k];
+    double freq = (double)t->counts[i] / records;
+    for (int d = 0; d < t->dims; d++)
+      vec[d] += freq * t->rows[(size_t)i * t->dims + d];
+    t->counts[i] = 0;
+  }
+  t->numTouched = 0;
+}
+
+//------------------------------------//
+//             Clustering             //
+//------------------------------------//
+
+static double dist2(const double *a, const double *b, int dims)
+{
+  double s = 0;
+  for (int d = 0; d < dims; d++)
+    s += (a[d] - b[d]) * (a[d] - b[d]);
+  return s;
+}
+
+// Cluster the 'n' vectors of 'x' around 'k' centers, seeded k-means++
+// style from 'rng'
+//
+// Returns the sum of squared distances of the vectors to their centers
+//
+static double kmeans(const double *x, int n, int dims, int k, uint64_t *rng, int *assign, double *centers)
+{
+  double *nearest = (double *)malloc(n * sizeof(double));
+  int *sizes = (int *)malloc(k * sizeof(int));
+
+  // Each further center is drawn in proportion to the squared distance
+  // to the nearest center so far
+  memcpy(centers, x + (size_t)(random_unit(rng) * n) * dims, dims * sizeof(double));
+  for (int i = 0; i < n; i++)
+    nearest[i] = dist2(x + (size_t)i * dims, centers, dims);
+  for (int c = 1; c < k; c++)
+  {
+    double total = 0;
+    for (int i = 0; i < n; i++)
+      total += nearest[i];
+    double r = random_unit(rng) * total;
+    int pick = n - 1;
+    for (int i = 0; i < n; i++)
+    {
+      r -= nearest[i];
+      if (r < 0)
+      {
+        pick = i;
+        break;
+      }
+    }
+    memcpy(centers + (size_t)c * dims, x + (size_t)pick * dims, dims * sizeof(double));
+    for (int i = 0; i < n; i++)
+    {
+      double d = dist2(x + (size_t)i * dims, centers + (size_t)c * dims, dims);
+      if (d < nearest[i])
+        nearest[i] = d;
+    }
+  }
+
+  for (int i = 0; i < n; i++)
+    assign[i] = -1;
+  double distortion = 0;
+  for (int iter = 0; iter < KMEANS_MAX_ITERS; iter++)
+  {
+    // Assign every vector to its nearest center
+    int changed = 0;
+    distortion = 0;
+    for (int i = 0; i < n; i++)
+    {
+      int best = 0;
+      double bestDist = dist2(x + (size_t)i * dims, centers, dims);
+      for (int c = 1; c < k; c++)
+      {
+        double d = dist2(x + (size_t)i * dims, centers + (size_t)c * dims, dims);
+        if (d < bestDist)
+        {
+          best = c;
+          bestDist = d;
+        }
+      }
+      changed |= (assign[i] != best);
+      assign[i] = best;
+      nearest[i] = bestDist;
+      distortion += bestDist;
+    }
+    if (!changed)
+      break;
+
+    // Move every center to the mean of its vectors; an empty cluster
+    // takes the vector farthest from its center
+    memset(centers, 0, (size_t)k * dims * sizeof(double));
+    memset(sizes, 0, k * sizeof(int));
+    for (int i = 0; i < n; i++)
+    {
+      sizes[assign[i]]++;
+      for (int d = 0; d < dims; d++)
+        centers[(size_t)assign[i] * dims + d] += x[(size_t)i * dims + d];
+    }
+    for (int c = 0; c < k; c++)
+    {
+      if (sizes[c] == 0)
+      {
+        int far = 0;
+        for (int i = 1; i < n; i++)
+        {
+          if (nearest[i] > nearest[far])
+            far = i;
+        }
+        memcpy(centers + (size_t)c * dims, x + (size_t)far * dims, dims * sizeof(double));
+        nearest[far] = 0;
+        continue;
+      }
+      for (int d = 0; d < dims; d++)
+        centers[(size_t)c * dims + d] /= sizes[c];
+    }
+  }
+
+  free(nearest);
+  free(sizes);
+  return distortion;
+}
+
+// Bayesian information criterion of a clustering, modelling each cluster
+// as a spherical Gaussian of a shared variance (Pelleg and Moore's
+// X-means); higher is better
+//
+static double bic(int n, int dims, int k, const int *assign, double distortion)
+{
+  if (n <= k)
+    return -HUGE_VAL;
+
+  int *sizes = (int *)calloc(k, sizeof(int));
+  for (int i = 0; i < n; i++)
+    sizes[assign[i]]++;
+
+  double variance = distortion / ((double)(n - k) * dims);
+  if (variance < 1e-12)
+    variance = 1e-12;
+  double likelihood = 0;
+  for (int c = 0; c < k; c++)
+  {
+    double r = sizes[c];
+    if (r == 0)
+      continue;
+    likelihood += -r / 2 * log(2 * M_PI) - r * dims / 2 * log(variance) - (r - k) / 2 + r * log(r) - r * log((double)n);
+  }
+  free(sizes);
+
+  double params = (k - 1) + (double)dims * k + 1;
+  return likelihood - params / 2 * log((double)n);
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t intervalRecords = 100000;
+  int maxK = 10;
+  int dims = 15;
+  uint64_t seed = 1;
+  const char *paths[2];
+  int numPaths = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--help"))
+    {
+      usage();
+      exit(0);
+    }
+    else if (!strncmp(argv[i], "--interval=", 11))
+    {
+      intervalRecords = strtoull(argv[i] + 11, NULL, 10);
+    }
+    else if (!strncmp(argv[i], "--maxk=", 7))
+    {
+      maxK = atoi(argv[i] + 7);
+    }
+    else if (!strncmp(argv[i], "--dims=", 7))
+    {
+      dims = atoi(argv[i] + 7);
+    }
+    else if (!strncmp(argv[i], "--seed=", 7))
+    {
+      seed = strtoull(argv[i] + 7, NULL, 10);
+    }
+    else if (numPaths < 2 && strncmp(argv[i], "--", 2))
+    {
+      paths[numPaths++] = argv[i];
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+  if (numPaths != 2 || intervalRecords == 0 || maxK < 1 || dims < 1 || dims > MAX_DIMS)
+  {
+    usage();
+    exit(1);
+  }
+
+  trace_reader trace;
+  if (!trace_open(&trace, paths[0], sysconf(_SC_NPROCESSORS_ONLN)))
+  {
+    exit(1);
+  }
+
+  // One projected vector per interval; a last, shorter interval is kept
+  // and weighs as much as the others
+  pc_table pcs;
+  pc_table_init(&pcs, dims, seed);
+  int numIntervals = 0;
+  int capacity = 256;
+  double *vectors = (double *)malloc((size_t)capacity * dims * sizeof(double));
+  uint64_t inInterval = 0;
+  uint64_t num_records = 0;
+  while (trace_fill(&trace) > 0)
+  {
+    for (size_t k = 0; k < trace.count; k++)
+    {
+      pc_table_count(&pcs, trace.recs[k].pc);
+      if (++inInterval == intervalRecords)
+      {
+        if (numIntervals == capacity)
+        {
+          capacity *= 2;
+          vectors = (double *)realloc(vectors, (size_t)capacity * dims * sizeof(double));
+        }
+        pc_table_project(&pcs, inInterval, vectors + (size_t)numIntervals++ * dims);
+        inInterval = 0;
+      }
+    }
+    num_records += trace.count;
+  }
+  if (inInterval > 0)
+  {
+    if (numIntervals == capacity)
+      vectors = (double *)realloc(vectors, (size_t)(capacity + 1) * dims * sizeof(double));
+    pc_table_project(&pcs, inInterval, vectors + (size_t)numIntervals++ * dims);
+  }
+  trace_close(&trace);
+  if (numIntervals == 0)
+  {
+    fprintf(stderr, "Error: %s holds no records\n", paths[0]);
+    exit(1);
+  }
+
+  printf("Records:         %10llu\n", (unsigned long long)num_records);
+  printf("Intervals:       %10d\n", numIntervals);
+  printf("Branch PCs:      %10d\n", pcs.numPcs);
+
+  // Cluster for every k, keeping the best of a few seeds for each
+  if (maxK > numIntervals)
+    maxK = numIntervals;
+  int *assign = (int *)malloc(numIntervals * sizeof(int));
+  int *bestAssign = (int *)malloc((size_t)maxK * numIntervals * sizeof(int));
+  double *centers = (double *)malloc((size_t)maxK * dims * sizeof(double));
+  double *bestCenters = (double *)malloc((size_t)maxK * maxK * dims * sizeof(double));
+  double *scores = (double *)malloc(maxK * sizeof(double));
+  uint64_t rng = splitmix64(seed);
+  printf("%3s %14s %14s\n", "k", "Distortion", "BIC");
+  for (int k = 1; k <= maxK; k++)
+  {
+    double best = HUGE_VAL;
+    for (int r = 0; r < KMEANS_RESTARTS; r++)
+    {
+      double distortion = kmeans(vectors, numIntervals, dims, k, &rng, assign, centers);
+      if (distortion < best)
+      {
+        best = distortion;
+        memcpy(bestAssign + (size_t)(k - 1) * numIntervals, assign, numIntervals * sizeof(int));
+        memcpy(bestCenters + (size_t)(k - 1) * maxK * dims, centers, (size_t)k * dims * sizeof(double));
+      }
+    }
+    scores[k - 1] = bic(numIntervals, dims, k, bestAssign + (size_t)(k - 1) * numIntervals, best);
+    printf("%3d %14.6g %14.6g\n", k, best, scores[k - 1]);
+  }
+
+  // The smallest k that comes close enough to the best score
+  double lo = HUGE_VAL, hi = -HUGE_VAL;
+  for (int k = 1; k <= maxK; k++)
+  {
+    if (scores[k - 1] == -HUGE_VAL)
+      continue;
+    lo = (scores[k - 1] < lo) ? scores[k - 1] : lo;
+    hi = (scores[k - 1] > hi) ? scores[k - 1] : hi;
+  }
+  int chosen = 1;
+  while (chosen < maxK && !(scores[chosen - 1] >= lo + BIC_THRESHOLD * (hi - lo)))
+    chosen++;
+
+  // The interval nearest each centroid stands for its cluster
+  const int *clusters = bestAssign + (size_t)(chosen - 1) * numIntervals;
+  const double *chosenCenters = bestCenters + (size_t)(chosen - 1) * maxK * dims;
+  simpoint_set set;
+  set.intervalRecords = intervalRecords;
+  set.numIntervals = numIntervals;
+  set.numPoints = 0;
+  set.points = (simpoint *)malloc(chosen * sizeof(simpoint));
+  for (int c = 0; c < chosen; c++)
+  {
+    int size = 0, pick = -1;
+    double pickDist = HUGE_VAL;
+    for (int i = 0; i < numIntervals; i++)
+    {
+      if (clusters[i] != c)
+        continue;
+      size++;
+      double d = dist2(vectors + (size_t)i * dims, chosenCenters + (size_t)c * dims, dims);
+      if (d < pickDist)
+      {
+        pick = i;
+        pickDist = d;
+      }
+    }
+    if (pick < 0)
+      continue;
+    set.points[set.numPoints].interval = pick;
+    set.points[set.numPoints].weight = (double)size / numIntervals;
+    set.numPoints++;
+  }
+
+  sort_simpoints(&set);
+  printf("Chosen k:        %10d\n", set.numPoints);
+  printf("%10s %10s\n", "Interval", "Weight");
+  for (int i = 0; i < set.numPoints; i++)
+    printf("%10llu %10.4f\n", (unsigned long long)set.points[i].interval, set.points[i].weight);
+  int ok = write_simpoints(paths[1], &set);
+
+  // Cleanup
+  free_simpoints(&set);
+  free(assign);
+  free(bestAssign);
+  free(centers);
+  free(bestCenters);
+  free(scores);
+  free(vectors);
+  pc_table_free(&pcs);
+
+  return !ok;
+}
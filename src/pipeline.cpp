@@ -0,0 +1,116 @@
+//========================================================//
+//  pipeline.cpp                                          //
+//  Source file for delayed predictor updates             //
+//                                                        //
+//  Predictions are kept in a ring until the window has   //
+//  moved past them, then trained in order                //
+//========================================================//
+#include <stdlib.h>
+#include <string.h>
+#include "pipeline.h"
+
+static const char *pipelineRepairNames[] = {"norepair", "repair", "checkpoint"};
+
+int parse_pipeline_config(const char *spec, pipeline_config *cfg)
+{
+  cfg->repair = PIPELINE_REPAIR;
+
+  char *end;
+  cfg->depth = strtol(spec, &end, 10);
+  if (end == spec || cfg->depth < 0 || cfg->depth > PIPELINE_MAX_DEPTH)
+    return 0;
+  if (*end == '\0')
+    return 1;
+  if (*end != ':')
+    return 0;
+
+  cfg->repair = -1;
+  for (int i = 0; i < 3; i++)
+  {
+    if (!strcmp(end + 1, pipelineRepairNames[i]))
+      cfg->repair = i;
+  }
+
+  // A repair undoes the shifts of every branch in flight
+  if (cfg->repair == PIPELINE_CHECKPOINT)
+    return cfg->depth < HISTORY_REPAIR_MAX;
+  return cfg->repair >= 0;
+}
+
+BranchPipeline::BranchPipeline(Predictor *p, const pipeline_config *cfg)
+{
+  this->p = p;
+  this->cfg = *cfg;
+
+  // Slots on cache line boundaries, at least one byte each
+  stride = (p->state_size() + 64) & ~(size_t)63;
+  histStride = (p->history_size() + 8) & ~(size_t)7;
+  slots = cfg->depth + 1;
+  states = (uint8_t *)aligned_alloc(64, slots * stride);
+  histories = (uint8_t *)malloc(slots * histStride);
+  pcs = (uint32_t *)malloc(slots * sizeof(uint32_t));
+  outcomes = (uint32_t *)malloc(slots * sizeof(uint32_t));
+  predictions = (uint32_t *)malloc(slots * sizeof(uint32_t));
+  head = 0;
+  count = 0;
+  refetches = 0;
+}
+
+BranchPipeline::~BranchPipeline()
+{
+  free(states);
+  free(histories);
+  free(pcs);
+  free(outcomes);
+  free(predictions);
+}
+
+// Predict the branch in 'slot' and shift it into the history
+void BranchPipeline::predict_slot(int slot)
+{
+  if (cfg.repair == PIPELINE_CHECKPOINT)
+    p->save_history(pcs[slot], histories + slot * histStride);
+  predictions[slot] = p->predict_state(pcs[slot], states + slot * stride);
+  p->shift_history(pcs[slot], (cfg.repair == PIPELINE_REPAIR) ? outcomes[slot] : predictions[slot]);
+}
+
+void BranchPipeline::fetch(uint32_t pc, uint32_t outcome)
+{
+  int slot = head + count;
+  if (slot >= slots)
+    slot -= slots;
+  pcs[slot] = pc;
+  outcomes[slot] = outcome;
+  predict_slot(slot);
+  count++;
+}
+
+int BranchPipeline::resolve(int drain, uint32_t *prediction, uint32_t *outcome)
+{
+  if (count == 0 || (!drain && count <= cfg.depth))
+    return 0;
+
+  int oldest = head;
+  *prediction = predictions[oldest];
+  *outcome = outcomes[oldest];
+  p->train_state(states + oldest * stride, outcomes[oldest]);
+  head = (head + 1 == slots) ? 0 : head + 1;
+  count--;
+
+  if (cfg.repair == PIPELINE_CHECKPOINT && *prediction != *outcome)
+  {
+    // Undo the shifts back to the mispredicted branch, youngest first
+    for (int k = count; k >= 0; k--)
+    {
+      int slot = (oldest + k) % slots;
+      p->restore_history(histories + slot * histStride);
+    }
+    p->shift_history(pcs[oldest], outcomes[oldest]);
+
+    // Fetch the younger branches again down the correct path
+    for (int k = 1; k <= count; k++)
+      predict_slot((oldest + k) % slots);
+    refetches += count;
+  }
+  return 1;
+}
@@ -0,0 +1,86 @@
+//========================================================//
+//  pipeline.h                                            //
+//  Header file for delayed predictor updates             //
+//                                                        //
+//  Conditional branches train a fixed number of branches //
+//  after their prediction, as they would when resolved   //
+//  deep in a pipeline                                    //
+//========================================================//
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdint.h>
+#include "predictor.h"
+
+// Longest in-flight window
+#define PIPELINE_MAX_DEPTH 4096
+
+// What the history holds for a mispredicted branch: its predicted
+// outcome for good, its actual outcome as if repaired at once, or its
+// predicted outcome until it resolves and the checkpoint taken before it
+// is restored
+#define PIPELINE_NOREPAIR 0
+#define PIPELINE_REPAIR 1
+#define PIPELINE_CHECKPOINT 2
+
+typedef struct
+{
+  int depth;   // Branches in flight, 0 if updates are immediate
+  int repair;  // PIPELINE_NOREPAIR, PIPELINE_REPAIR or PIPELINE_CHECKPOINT
+} pipeline_config;
+
+// Parse "<depth>[:<repair>]" into 'cfg'
+//
+// Returns True if Successful
+//
+int parse_pipeline_config(const char *spec, pipeline_config *cfg);
+
+// Drives a predictor with 'depth' conditional branches in flight. Each
+// prediction sees the tables as trained by the branches older than the
+// window, and the history of every branch fetched before it.
+//
+// With checkpoints, a mispredicted branch restores the history when it
+// resolves, and the younger branches in flight are fetched again: they
+// stand for the correct path fetched after the flush, so their new
+// predictions are the ones that count.
+//
+class BranchPipeline
+{
+public:
+  BranchPipeline(Predictor *p, const pipeline_config *cfg);
+  ~BranchPipeline();
+
+  // Predict the conditional branch at 'pc' and shift it into the history
+  //
+  void fetch(uint32_t pc, uint32_t outcome);
+
+  // Resolve and train the oldest branch once more than 'depth' are in
+  // flight, or while any is if 'drain' is set
+  //
+  // Returns True if a branch resolved, with its final prediction and its
+  // outcome in 'prediction' and 'outcome'
+  //
+  int resolve(int drain, uint32_t *prediction, uint32_t *outcome);
+
+  // Branches fetched again after a history repair
+  uint64_t refetches;
+
+private:
+  void predict_slot(int slot);
+
+  Predictor *p;
+  pipeline_config cfg;
+  uint8_t *states;      // Ring of depth + 1 prediction states
+  uint8_t *histories;   // and of history checkpoints
+  uint32_t *pcs;
+  uint32_t *outcomes;   // Resolved outcome of each
+  uint32_t *predictions;
+  size_t stride;
+  size_t histStride;
+  int slots;
+  int head;             // Oldest branch in flight
+  int count;
+};
+
+#endif
@@ -8,6 +8,12 @@
 #include <stdio.h>
 #include <math.h>
 #include "predictor.h"
+#include "counters.h"
+#include "history.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 //
 // TODO:Student Information
@@ -22,8 +28,9 @@ const char *email = "TODO";
 //------------------------------------//
 
 // Handy Global for use in output routines
-const char *bpName[4] = {"Static", "Gshare",
-                         "Tournament", "Custom"};
+const char *bpName[NUM_BP_TYPES] = {"Static", "Gshare",
+                                    "Tournament", "Custom", "Perceptron",
+                                    "TAGE-SC-L"};
 
 // define number of bits required for indexing the BHT here.
 int ghistoryBits = 15; // Number of bits used for Global History
@@ -34,51 +41,118 @@ int ghistoryBits_tournament = 15;
 int lhistoryBits = 12;
 int pcIndexBits = 12;
 
-int base_entries = 2048;
+int perceptronHistory = 48;
+int perceptronTables = 4;
+
+int tageComponents = 10;
+int tageMinHistory = 4;
+int tageMaxHistory = 300;
+
+int prefetchDistance = 16;
+
+const int base_entries = 2048;
 const int num_tag_tables = 4;
 uint64_t UGR_PERIOD = 262144ULL;// 256K branches
-int HIST_LENGTHS[num_tag_tables + 1] = {0, 14, 15, 44, 128};
+constexpr int HIST_LENGTHS[num_tag_tables + 1] = {0, 14, 15, 44, 128};
 
 int ghr_bits = 128;
 
-//#define TAG_ENTRY_BITS    (tagBits + tag_ctr_bits + tag_u_bits + tag_valid_bits)
-
 //------------------------------------//
 //      Predictor Data Structures     //
 //------------------------------------//
 
 //
-// TODO: Add your own Branch Predictor data structures here
+// Each predictor is an object owning its tables and history, so any
+// number of them can be simulated in one process or thread
 //
 // gshare
-uint8_t *bht_gshare;
-uint64_t ghistory;
+class GsharePredictor : public Predictor
+{
+public:
+  GsharePredictor(int historyBits);
+  static void config_budget(int historyBits, predictor_budget *b);
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct);
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+  size_t state_size();
+  uint32_t predict_state(uint32_t pc, void *state);
+  void train_state(const void *state, uint32_t outcome);
+  void shift_history(uint32_t pc, uint32_t outcome);
+  size_t history_size();
+  void save_history(uint32_t pc, void *buf);
+  void restore_history(const void *buf);
+  void budget(predictor_budget *b);
+  void snapshot(snapshot_io *io);
+  uint64_t run_batch(const branch_record *recs, size_t n, int distance, uint8_t *predictions);
+  void train_batch(const branch_record *recs, size_t n, int distance);
+  size_t lookahead_bytes();
+  void start_lookahead();
+  void lookahead(const branch_record *r);
+
+private:
+  int ghistoryBits;
+  CounterTable<2> bht_gshare;
+  uint64_t ghistory;
+  uint64_t aheadHistory;   // History of the record being prefetched
+};
 //
 // tournament
-uint16_t ghr;
-uint16_t *localHistoryTable;
-uint8_t *bht_local;
-uint8_t *bht_global;
-uint8_t *chooserTable;
-//
-// custom
-uint64_t ghr_custom_1;
-uint64_t ghr_custom_2;
-uint8_t last_pred;
-int last_provider;
-uint64_t branch_count;
-
-struct BaseEntry {
-    uint8_t ctr;   //2-bit ctr
+
+// Table indices of the prediction for one branch
+struct tournament_lookup
+{
+  uint32_t lht_index;
+  uint32_t bht_local_index;
+  uint32_t bht_global_index;
 };
 
-struct TaggedEntry {
-    uint16_t tag;  
-    uint8_t ctr : 3;   //3-bit ctr
-    uint8_t u : 2;     
-    uint8_t valid : 1;
+// The global history, and the local history one branch shifts
+struct tournament_history
+{
+  uint16_t ghr;
+  uint16_t local;
+  uint32_t lht_index;
 };
 
+class TournamentPredictor : public Predictor
+{
+public:
+  TournamentPredictor(int ghistoryBits, int lhistoryBits, int pcIndexBits);
+  ~TournamentPredictor();
+  static void config_budget(int ghistoryBits, int lhistoryBits, int pcIndexBits, predictor_budget *b);
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct);
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+  size_t state_size();
+  uint32_t predict_state(uint32_t pc, void *state);
+  void train_state(const void *state, uint32_t outcome);
+  void shift_history(uint32_t pc, uint32_t outcome);
+  size_t history_size();
+  void save_history(uint32_t pc, void *buf);
+  void restore_history(const void *buf);
+  void budget(predictor_budget *b);
+  void snapshot(snapshot_io *io);
+  uint64_t run_batch(const branch_record *recs, size_t n, int distance, uint8_t *predictions);
+  void train_batch(const branch_record *recs, size_t n, int distance);
+  size_t lookahead_bytes();
+  void start_lookahead();
+  void lookahead(const branch_record *r);
+
+private:
+  uint8_t get_local_prediction(uint32_t bht_local_index);
+  uint8_t get_global_prediction(uint32_t bht_global_index);
+  void lookup(uint32_t pc, tournament_lookup *l);
+
+  int ghistoryBits_tournament;
+  int lhistoryBits;
+  int pcIndexBits;
+  uint16_t ghr;
+  uint16_t aheadGhr;       // GHR of the record being prefetched
+  uint16_t *localHistoryTable;
+  CounterTable<3> bht_local;
+  CounterTable<2> bht_global;
+  CounterTable<2> chooserTable;
+};
+//
+// custom
 struct tage_table {
     int tableSize;
     int historyBits;
@@ -86,44 +160,425 @@ struct tage_table {
 };
 
 // Geometric history lengths and tag bits
-tage_table tageTables[num_tag_tables] = {
+constexpr tage_table tageTables[num_tag_tables] = {
     {.tableSize = 1024, .historyBits = HIST_LENGTHS[1], .numTagBits = 9},   // T1 short-history
     {.tableSize = 1024, .historyBits = HIST_LENGTHS[2], .numTagBits = 9},   // T2 medium-short
     {.tableSize = 1024,  .historyBits = HIST_LENGTHS[3], .numTagBits = 10},  // T3 medium-long
     {.tableSize = 1024,  .historyBits = HIST_LENGTHS[4], .numTagBits = 10}   // T4 long-history
 };
 
-BaseEntry* base_bht_table;
-TaggedEntry** tag_tables;
+// Tagged tables are stored structure-of-arrays: one tag array, one
+// counter array and one usefulness array, with the entries of table t
+// starting at tage_base(t) in each
+constexpr int tage_base(int t) {
+    return (t == 0) ? 0 : tage_base(t - 1) + tageTables[t - 1].tableSize;
+}
+constexpr int tageEntries = tage_base(num_tag_tables);
+
+// A stored tag is the tag with TAG_VALID set, or 0 for an invalid entry
+#define TAG_VALID 0x8000
+
+constexpr bool tags_fit(int t) {
+    return t == num_tag_tables || ((1 << tageTables[t].numTagBits) <= TAG_VALID && tags_fit(t + 1));
+}
+static_assert(tags_fit(0), "tag overlaps TAG_VALID");
+
+// Tables are matched four lanes at a time
+#define TAG_LANES ((num_tag_tables + 3) & ~3)
+
+// Everything the prediction for one branch looked up, so the update
+// for that branch need not repeat it
+struct tage_lookup {
+    uint32_t pc;
+    uint8_t valid;                     // Not yet consumed by train()
+    uint32_t baseIndex;
+    uint32_t entry[TAG_LANES];         // tage_base(t) + index into table t
+    uint32_t want[TAG_LANES];          // Stored tag a match needs
+    uint32_t hitMask;                  // Bit t set if table t matched
+    int provider;                      // Longest matching table, or -1
+    int altProvider;                   // Next longest, or -1
+    uint8_t altpred;
+    uint8_t pred;
+};
+
+// The GHR and the folded histories derived from it
+struct tage_history {
+    uint64_t ghr_custom_1;
+    uint64_t ghr_custom_2;
+    uint32_t indexFold[num_tag_tables];
+    uint32_t tagFold[num_tag_tables];
+};
+
+class TagePredictor : public Predictor
+{
+public:
+  TagePredictor();
+  ~TagePredictor();
+  static void config_budget(predictor_budget *b);
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct);
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+  size_t state_size();
+  uint32_t predict_state(uint32_t pc, void *state);
+  void train_state(const void *state, uint32_t outcome);
+  void shift_history(uint32_t pc, uint32_t outcome);
+  size_t history_size();
+  void save_history(uint32_t pc, void *buf);
+  void restore_history(const void *buf);
+  void budget(predictor_budget *b);
+  void snapshot(snapshot_io *io);
+  uint64_t run_batch(const branch_record *recs, size_t n, int distance, uint8_t *predictions);
+  void train_batch(const branch_record *recs, size_t n, int distance);
+  size_t lookahead_bytes();
+  void start_lookahead();
+  void lookahead(const branch_record *r);
+
+private:
+  uint32_t compute_index(uint32_t pc, const tage_table *table);
+  uint16_t compute_tag(uint32_t pc, const tage_table *table);
+  void lookup(uint32_t pc, tage_lookup *l);
+  void allocate_on_mispredict(const tage_lookup *l, int provider, uint8_t outcome);
+  void maybe_graceful_u_reset();
+  void update_folds(uint32_t outcome);
+
+  uint64_t ghr_custom_1;
+  uint64_t ghr_custom_2;
+  uint32_t indexFold[num_tag_tables];  // Folded histories, see fold_kernel
+  uint32_t tagFold[num_tag_tables];
+  tage_history ahead;              // Histories of the record being prefetched
+  tage_lookup last;
+  uint64_t branch_count;
+  CounterTable<2> base_bht_table;  //2-bit ctrs
+  uint16_t *tag_store;             // Stored tags, see TAG_VALID
+  CounterTable<3> ctr_store;       //3-bit ctrs
+  CounterTable<2> u_store;
+};
+//
+// static
+class StaticPredictor : public Predictor
+{
+public:
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct) { return TAKEN; }
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct) {}
+  size_t state_size() { return 0; }
+  uint32_t predict_state(uint32_t pc, void *state) { return TAKEN; }
+  void train_state(const void *state, uint32_t outcome) {}
+  void shift_history(uint32_t pc, uint32_t outcome) {}
+  size_t history_size() { return 0; }
+  void save_history(uint32_t pc, void *buf) {}
+  void restore_history(const void *buf) {}
+  void budget(predictor_budget *b) {}
+  void snapshot(snapshot_io *io) {}
+};
+
+//
+// perceptron
+#define PERCEPTRON_MAX_TABLES 8
+#define PERCEPTRON_BIAS_ENTRIES 256
+#define PERCEPTRON_LANES 16       // int8 weights per SSE vector
+#define PERCEPTRON_HIST_BUF 2048  // Sliding history window, see shift_history
+#define PERCEPTRON_MAX_WINDOW 160 // History bytes the tables read, at most
+
+// Sum, or train, the weight rows of every table against the history.
+// hist[k] is 0 for taken and -1 for not taken, so a weight enters the sum
+// as (w ^ hist[k]) - hist[k]. Table t sees hist + t * segLen; laneMask
+// marks the real weights of each row, the rest pad it to whole vectors.
+typedef int (*perceptron_dot_fn)(int8_t *const *rows, const int8_t *hist, int tables, int segLen, int lanes);
+typedef void (*perceptron_update_fn)(int8_t *const *rows, const int8_t *hist, const int8_t *laneMask,
+                                     int tables, int segLen, int lanes, int8_t outcomeMask);
+
+// The rows and output of the prediction for one branch, reused by train()
+struct perceptron_lookup {
+    uint32_t pc;
+    uint8_t valid;                         // Not yet consumed by train()
+    uint32_t biasIndex;
+    int8_t *rows[PERCEPTRON_MAX_TABLES];   // Weight row of each table
+    int y;                                 // Perceptron output
+};
+
+// A pipelined prediction also keeps the history it was made with
+struct perceptron_state {
+    perceptron_lookup l;
+    int8_t hist[PERCEPTRON_MAX_WINDOW];
+};
+
+// Restoring the shift count also moves the window back up histBuf
+struct perceptron_history {
+    uint64_t shifts;
+    uint64_t ghist;
+};
+
+class PerceptronPredictor : public Predictor
+{
+public:
+  PerceptronPredictor(int historyLength, int numTables);
+  ~PerceptronPredictor();
+  static int row_bits(int historyLength);
+  static void config_budget(int historyLength, predictor_budget *b);
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct);
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+  size_t state_size();
+  uint32_t predict_state(uint32_t pc, void *state);
+  void train_state(const void *state, uint32_t outcome);
+  void shift_history(uint32_t pc, uint32_t outcome);
+  size_t history_size();
+  void save_history(uint32_t pc, void *buf);
+  void restore_history(const void *buf);
+  void budget(predictor_budget *b);
+  void snapshot(snapshot_io *io);
+
+private:
+  void lookup(uint32_t pc, perceptron_lookup *l);
+  void train_lookup(const perceptron_lookup *l, const int8_t *hist, uint32_t outcome);
+
+  int historyLength;
+  int numTables;
+  int segLen;              // History bits, and weights, per table
+  int lanes;               // segLen rounded up to whole vectors
+  int rowBits;             // log2 of the rows per table
+  int threshold;           // Train while |y| is at most this
+  int8_t *weights;         // numTables x rows x lanes
+  int8_t *laneMask;        // numTables x lanes, -1 on real weights
+  int8_t bias[PERCEPTRON_BIAS_ENTRIES];
+  int8_t histBuf[PERCEPTRON_HIST_BUF]; // Newest outcome at histBuf[histPos]
+  int histPos;
+  uint64_t shifts;         // Outcomes shifted in so far
+  uint64_t ghist;          // Newest outcomes, for the row hashes
+  uint64_t histMask[PERCEPTRON_MAX_TABLES]; // Bits of ghist hashed by each table
+  perceptron_dot_fn dot;
+  perceptron_update_fn update;
+  perceptron_lookup last;
+};
+
+//
+// tage-sc-l
+#define TSL_MAX_TABLES 16
+#define TSL_LOG_BASE 11         // log2 of the bimodal entries
+#define TSL_MIN_TAG_BITS 8      // Tag width of the shortest history table
+#define TSL_MAX_TAG_BITS 12     // and of the longest
+#define TSL_PHIST_BITS 16       // Path history
+#define TSL_HIST_BUF 4096       // Sliding history window, see shift_history
+#define TSL_SC_TABLES 5         // Bias table and four GEHL tables
+#define TSL_LOG_SC 8
+#define TSL_SC_CTR_BITS 6
+#define TSL_LOOP_ENTRIES 32
+#define TSL_LOOP_TAG_BITS 10
+#define TSL_LOOP_ITER_BITS 10
+#define TSL_LOOP_CONF_MAX 3     // 2-bit confidence
+#define TSL_LOOP_AGE_MAX 7      // 3-bit age
+
+// A loop predictor entry, tracking the trip count of one loop branch
+struct loop_entry {
+    uint16_t tag;
+    uint16_t pastIter;   // Trip count, 0 while still learning it
+    uint16_t curIter;    // Iterations of the current trip
+    uint8_t conf;        // Trips in a row that matched pastIter
+    uint8_t age;         // Replaced once it decays to 0
+    uint8_t dir;         // Direction of the loop body
+};
+
+// Everything the prediction for one branch looked up, so the update
+// for that branch need not repeat it
+struct tagescl_lookup {
+    uint32_t pc;
+    uint8_t valid;                     // Not yet consumed by train()
+    uint32_t baseIndex;
+    uint32_t index[TSL_MAX_TABLES];    // Entry within each tagged table
+    uint16_t tag[TSL_MAX_TABLES];
+    int provider;                      // Longest matching table, or -1
+    int altProvider;                   // Next longest, or -1
+    uint8_t providerPred;
+    uint8_t altpred;
+    uint8_t newEntry;                  // Provider weak and not yet useful
+    uint8_t tagePred;
+    uint8_t highConf;                  // Provider counter saturated
+    uint32_t loopIndex;
+    uint8_t loopHit;
+    uint8_t loopValid;                 // Loop entry confident
+    uint8_t loopPred;
+    uint8_t preScPred;                 // TAGE, or the loop if it overrode it
+    uint32_t scIndex[TSL_SC_TABLES];
+    int scSum;
+    uint8_t pred;
+};
+
+// Every register derived from the history buffer, and the shift count
+// locating the window in it
+struct tagescl_history {
+    uint64_t shifts;
+    uint64_t ghist;
+    uint32_t phist;
+    uint32_t indexComp[TSL_MAX_TABLES];
+    uint32_t tagComp0[TSL_MAX_TABLES];
+    uint32_t tagComp1[TSL_MAX_TABLES];
+};
+
+// TAGE with a configurable number of geometric history components, a
+// loop predictor and a GEHL statistical corrector. Tables are sized at
+// construction so the whole engine fits the hardware budget.
+class TageSclPredictor : public Predictor
+{
+public:
+  TageSclPredictor(int numComponents, int minHistory, int maxHistory);
+  ~TageSclPredictor();
+  static int size_tables(int numComponents, int minHistory, int maxHistory, int *histLength, int *tagBits,
+                         int *logEntries);
+  static void config_budget(int numTables, const int *histLength, const int *tagBits, const int *logEntries,
+                            predictor_budget *b);
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct);
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+  size_t state_size();
+  uint32_t predict_state(uint32_t pc, void *state);
+  void train_state(const void *state, uint32_t outcome);
+  void shift_history(uint32_t pc, uint32_t outcome);
+  size_t history_size();
+  void save_history(uint32_t pc, void *buf);
+  void restore_history(const void *buf);
+  void budget(predictor_budget *b);
+  void snapshot(snapshot_io *io);
+
+private:
+  void lookup(uint32_t pc, tagescl_lookup *l);
+  void loop_lookup(uint32_t pc, tagescl_lookup *l);
+  void sc_lookup(uint32_t pc, tagescl_lookup *l);
+  void tage_update(const tagescl_lookup *l, uint32_t outcome);
+  void loop_update(const tagescl_lookup *l, uint32_t outcome);
+  void sc_update(const tagescl_lookup *l, uint32_t outcome);
+  uint32_t random();
+
+  int numTables;
+  int histLength[TSL_MAX_TABLES];
+  int logEntries[TSL_MAX_TABLES];
+  int tagBits[TSL_MAX_TABLES];
+
+  // TAGE
+  CounterTable<2> base_bht_table;
+  uint16_t *tags[TSL_MAX_TABLES];
+  CounterTable<3> ctr[TSL_MAX_TABLES];
+  CounterTable<2> u[TSL_MAX_TABLES];
+  int8_t useAltOnNa;                 // 4-bit, >= 0 trusts alt over new entries
+  uint64_t branch_count;
+
+  // Loop predictor
+  loop_entry loops[TSL_LOOP_ENTRIES];
+  int8_t withLoop;                   // 7-bit, >= 0 trusts confident loops
+
+  // Statistical corrector
+  int8_t *sc[TSL_SC_TABLES];         // 6-bit signed counters
+  int scThreshold;
+  int scTc;                          // Threshold adaptation counter
+
+  // Histories
+  uint8_t histBuf[TSL_HIST_BUF];     // Newest outcome at histBuf[histPos]
+  int histPos;
+  uint64_t shifts;                   // Outcomes shifted in so far
+  uint64_t ghist;                    // Newest outcomes, for the GEHL tables
+  uint32_t phist;                    // Path history
+  folded_history indexFold[TSL_MAX_TABLES];
+  folded_history tagFold0[TSL_MAX_TABLES];
+  folded_history tagFold1[TSL_MAX_TABLES];
+  uint32_t seed;
+
+  tagescl_lookup last;
+};
+
+// The predictor behind init_predictor/make_prediction/train_predictor
+Predictor *activePredictor = NULL;
 
 //------------------------------------//
 //        Predictor Functions         //
 //------------------------------------//
 
+// batch functions
+uint64_t Predictor::run_batch(const branch_record *recs, size_t n, int distance, uint8_t *predictions)
+{
+  uint64_t mispredictions = 0;
+  for (size_t k = 0; k < n; k++)
+  {
+    const branch_record *r = &recs[k];
+    if (r->condition)
+    {
+      uint32_t prediction = predict(r->pc, r->target, r->direct);
+      if (prediction != r->outcome)
+        mispredictions++;
+      if (predictions != NULL)
+        predictions[k] = prediction;
+    }
+    train(r->pc, r->target, r->outcome, r->condition, r->call, r->ret, r->direct);
+  }
+  return mispredictions;
+}
+
+void Predictor::train_batch(const branch_record *recs, size_t n, int distance)
+{
+  for (size_t k = 0; k < n; k++)
+  {
+    const branch_record *r = &recs[k];
+    train(r->pc, r->target, r->outcome, r->condition, r->call, r->ret, r->direct);
+  }
+}
+
+// Tables smaller than this mostly stay cached, and a lookahead would only
+// cost time
+#define PREFETCH_MIN_BYTES (1 << 20)
+
+// run_batch, or train_batch unless 'Score', of a predictor class P with a
+// lookahead over P::lookahead_bytes() of tables. P::start_lookahead()
+// copies the histories, then P::lookahead() prefetches the entries of
+// each record 'distance' records ahead of the one simulated and shifts
+// its outcome into the copy. The calls are qualified, so they are bound
+// statically and inlined.
+//
+template <bool Score, class P>
+static uint64_t run_lookahead(P *p, const branch_record *recs, size_t n, int distance, uint8_t *predictions)
+{
+  size_t ahead = n;
+  if (distance > 0 && p->P::lookahead_bytes() >= PREFETCH_MIN_BYTES)
+  {
+    p->P::start_lookahead();
+    for (ahead = 0; ahead < n && ahead < (size_t)distance; ahead++)
+      p->P::lookahead(&recs[ahead]);
+  }
+
+  uint64_t mispredictions = 0;
+  for (size_t k = 0; k < n; k++)
+  {
+    if (ahead < n)
+      p->P::lookahead(&recs[ahead++]);
+
+    const branch_record *r = &recs[k];
+    if (Score && r->condition)
+    {
+      uint32_t prediction = p->P::predict(r->pc, r->target, r->direct);
+      if (prediction != r->outcome)
+        mispredictions++;
+      if (predictions != NULL)
+        predictions[k] = prediction;
+    }
+    p->P::train(r->pc, r->target, r->outcome, r->condition, r->call, r->ret, r->direct);
+  }
+  return mispredictions;
+}
+
 // Initialize the predictor
 //
 
 // gshare functions
-void init_gshare()
+GsharePredictor::GsharePredictor(int historyBits)
 {
+  ghistoryBits = historyBits;
   int bht_entries = 1 << ghistoryBits;
-  bht_gshare = (uint8_t *)malloc(bht_entries * sizeof(uint8_t));
-  int i = 0;
-  for (i = 0; i < bht_entries; i++)
-  {
-    bht_gshare[i] = WN;
-  }
+  bht_gshare.init(bht_entries, WN);
   ghistory = 0;
 }
 
-uint8_t gshare_predict(uint32_t pc)
+uint32_t GsharePredictor::predict(uint32_t pc, uint32_t target, uint32_t direct)
 {
   // get lower ghistoryBits of pc
   uint32_t bht_entries = 1 << ghistoryBits;
   uint32_t pc_lower_bits = pc & (bht_entries - 1);
   uint32_t ghistory_lower_bits = ghistory & (bht_entries - 1);
   uint32_t index = pc_lower_bits ^ ghistory_lower_bits;
-  switch (bht_gshare[index])
+  switch (bht_gshare.get(index))
   {
   case WN:
     return NOTTAKEN;
@@ -139,115 +594,319 @@ uint8_t gshare_predict(uint32_t pc)
   }
 }
 
-void train_gshare(uint32_t pc, uint8_t outcome)
+void GsharePredictor::train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
 {
+  if (!condition)
+    return;
+
   // get lower ghistoryBits of pc
   uint32_t bht_entries = 1 << ghistoryBits;
   uint32_t pc_lower_bits = pc & (bht_entries - 1);
   uint32_t ghistory_lower_bits = ghistory & (bht_entries - 1);
   uint32_t index = pc_lower_bits ^ ghistory_lower_bits;
 
+  GsharePredictor::train_state(&index, outcome);
+  GsharePredictor::shift_history(pc, outcome);
+}
+
+// The state of a prediction is its BHT index
+size_t GsharePredictor::state_size()
+{
+  return sizeof(uint32_t);
+}
+
+uint32_t GsharePredictor::predict_state(uint32_t pc, void *state)
+{
+  uint32_t bht_entries = 1 << ghistoryBits;
+  *(uint32_t *)state = (pc ^ ghistory) & (bht_entries - 1);
+  return GsharePredictor::predict(pc, 0, 0);
+}
+
+void GsharePredictor::train_state(const void *state, uint32_t outcome)
+{
+  uint32_t index = *(const uint32_t *)state;
+
   // Update state of entry in bht based on outcome
-  switch (bht_gshare[index])
+  switch (bht_gshare.get(index))
   {
   case WN:
-    bht_gshare[index] = (outcome == TAKEN) ? WT : SN;
+    bht_gshare.set(index, (outcome == TAKEN) ? WT : SN);
     break;
   case SN:
-    bht_gshare[index] = (outcome == TAKEN) ? WN : SN;
+    bht_gshare.set(index, (outcome == TAKEN) ? WN : SN);
     break;
   case WT:
-    bht_gshare[index] = (outcome == TAKEN) ? ST : WN;
+    bht_gshare.set(index, (outcome == TAKEN) ? ST : WN);
     break;
   case ST:
-    bht_gshare[index] = (outcome == TAKEN) ? ST : WT;
+    bht_gshare.set(index, (outcome == TAKEN) ? ST : WT);
     break;
   default:
     printf("Warning: Undefined state of entry in GSHARE BHT!\n");
     break;
   }
+}
 
+void GsharePredictor::shift_history(uint32_t pc, uint32_t outcome)
+{
   // Update history register
   ghistory = ((ghistory << 1) | outcome);
 }
 
-void cleanup_gshare()
+size_t GsharePredictor::history_size()
 {
-  free(bht_gshare);
+  return sizeof(uint64_t);
 }
 
-// tournament functions
-void init_tournament()
+void GsharePredictor::save_history(uint32_t pc, void *buf)
 {
-  int lht_entries = 1 << pcIndexBits;
-  localHistoryTable = (uint16_t *)malloc(lht_entries * sizeof(uint16_t));
+  *(uint64_t *)buf = ghistory;
+}
 
-  int bht_local_entries = 1 << lhistoryBits;
-  bht_local = (uint8_t *)malloc(bht_local_entries * sizeof(uint8_t));
+void GsharePredictor::restore_history(const void *buf)
+{
+  ghistory = *(const uint64_t *)buf;
+}
 
-  int bht_global_entries = 1 << ghistoryBits_tournament;
-  bht_global = (uint8_t *)malloc(bht_global_entries * sizeof(uint8_t));
+void GsharePredictor::config_budget(int historyBits, predictor_budget *b)
+{
+  budget_add(b, "BHT counters", (1ULL << historyBits) * 2, 0);
+  budget_add(b, "Global history", historyBits, 1);
+}
 
-  int chooser_entries = 1 << ghistoryBits_tournament;
-  chooserTable = (uint8_t *)malloc(chooser_entries * sizeof(uint8_t));
+void GsharePredictor::budget(predictor_budget *b)
+{
+  config_budget(ghistoryBits, b);
+}
 
-  for (int i = 0; i < lht_entries; i++)
+void GsharePredictor::snapshot(snapshot_io *io)
+{
+  snapshot_bytes(io, bht_gshare.data(), bht_gshare.size_bytes());
+  snapshot_bytes(io, &ghistory, sizeof(ghistory));
+}
+
+uint64_t GsharePredictor::run_batch(const branch_record *recs, size_t n, int distance, uint8_t *predictions)
+{
+  return run_lookahead<true>(this, recs, n, distance, predictions);
+}
+
+void GsharePredictor::train_batch(const branch_record *recs, size_t n, int distance)
+{
+  run_lookahead<false>(this, recs, n, distance, NULL);
+}
+
+size_t GsharePredictor::lookahead_bytes()
+{
+  return bht_gshare.size_bytes();
+}
+
+void GsharePredictor::start_lookahead()
+{
+  aheadHistory = ghistory;
+}
+
+void GsharePredictor::lookahead(const branch_record *r)
+{
+  if (!r->condition)
+    return;
+
+  bht_gshare.prefetch((r->pc ^ aheadHistory) & ((1u << ghistoryBits) - 1));
+  aheadHistory = (aheadHistory << 1) | r->outcome;
+}
+
+
+// gshare with the history length fixed at compile time, so the masks are
+// constants and the 2-bit counter update needs no switch
+template <int HistBits>
+class GshareKernel : public Predictor
+{
+public:
+  GshareKernel()
   {
-    localHistoryTable[i] = 0;
+    bht_gshare.init(BHT_ENTRIES, WN);
+    ghistory = 0;
+  }
+
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct)
+  {
+    return (bht_gshare.get((pc ^ ghistory) & MASK) >= WT) ? TAKEN : NOTTAKEN;
+  }
+
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+  {
+    if (!condition)
+      return;
+
+    uint32_t index = (pc ^ ghistory) & MASK;
+    GshareKernel::train_state(&index, outcome);
+    GshareKernel::shift_history(pc, outcome);
+  }
+
+  size_t state_size() { return sizeof(uint32_t); }
+
+  uint32_t predict_state(uint32_t pc, void *state)
+  {
+    *(uint32_t *)state = (pc ^ ghistory) & MASK;
+    return GshareKernel::predict(pc, 0, 0);
+  }
+
+  void train_state(const void *state, uint32_t outcome)
+  {
+    uint32_t index = *(const uint32_t *)state;
+    if (outcome == TAKEN)
+      bht_gshare.increment(index);
+    else
+      bht_gshare.decrement(index);
+  }
+
+  void shift_history(uint32_t pc, uint32_t outcome)
+  {
+    ghistory = ((ghistory << 1) | outcome);
+  }
+
+  size_t history_size() { return sizeof(uint64_t); }
+  void save_history(uint32_t pc, void *buf) { *(uint64_t *)buf = ghistory; }
+  void restore_history(const void *buf) { ghistory = *(const uint64_t *)buf; }
+
+  void budget(predictor_budget *b)
+  {
+    GsharePredictor::config_budget(HistBits, b);
+  }
+
+  void snapshot(snapshot_io *io)
+  {
+    snapshot_bytes(io, bht_gshare.data(), bht_gshare.size_bytes());
+    snapshot_bytes(io, &ghistory, sizeof(ghistory));
   }
 
-  for (int i = 0; i < bht_local_entries; i++)
+  uint64_t run_batch(const branch_record *recs, size_t n, int distance, uint8_t *predictions)
   {
-    bht_local[i] = SNK; //slightly not taken
+    return run_lookahead<true>(this, recs, n, distance, predictions);
   }
 
-  for (int i = 0; i < bht_global_entries; i++)
+  void train_batch(const branch_record *recs, size_t n, int distance)
   {
-    bht_global[i] = WN;
+    run_lookahead<false>(this, recs, n, distance, NULL);
   }
 
-  for (int i = 0; i < chooser_entries; i++)
+  size_t lookahead_bytes() { return bht_gshare.size_bytes(); }
+
+  void start_lookahead() { aheadHistory = ghistory; }
+
+  void lookahead(const branch_record *r)
+  {
+    if (!r->condition)
+      return;
+
+    bht_gshare.prefetch((r->pc ^ aheadHistory) & MASK);
+    aheadHistory = (aheadHistory << 1) | r->outcome;
+  }
+
+private:
+  static constexpr uint32_t BHT_ENTRIES = 1u << HistBits;
+  static constexpr uint32_t MASK = BHT_ENTRIES - 1;
+
+  CounterTable<2> bht_gshare;
+  uint64_t ghistory;
+  uint64_t aheadHistory;
+};
+
+template <int HistBits>
+static Predictor *new_gshare_kernel()
+{
+  return new GshareKernel<HistBits>();
+}
+
+// Pre-instantiated history lengths; others use GsharePredictor
+#define GSHARE_KERNEL_MIN 8
+#define GSHARE_KERNEL_MAX 20
+
+static Predictor *(*const gshareKernels[])() = {
+    new_gshare_kernel<8>, new_gshare_kernel<9>, new_gshare_kernel<10>,
+    new_gshare_kernel<11>, new_gshare_kernel<12>, new_gshare_kernel<13>,
+    new_gshare_kernel<14>, new_gshare_kernel<15>, new_gshare_kernel<16>,
+    new_gshare_kernel<17>, new_gshare_kernel<18>, new_gshare_kernel<19>,
+    new_gshare_kernel<20>,
+};
+
+// tournament functions
+TournamentPredictor::TournamentPredictor(int ghistoryBits, int lhistoryBits, int pcIndexBits)
+{
+  this->ghistoryBits_tournament = ghistoryBits;
+  this->lhistoryBits = lhistoryBits;
+  this->pcIndexBits = pcIndexBits;
+
+  int lht_entries = 1 << pcIndexBits;
+  localHistoryTable = (uint16_t *)malloc(lht_entries * sizeof(uint16_t));
+
+  int bht_local_entries = 1 << lhistoryBits;
+  bht_local.init(bht_local_entries, SNK); //slightly not taken
+
+  int bht_global_entries = 1 << ghistoryBits_tournament;
+  bht_global.init(bht_global_entries, WN);
+
+  int chooser_entries = 1 << ghistoryBits_tournament;
+  chooserTable.init(chooser_entries, WEAK_LOCAL);
+
+  for (int i = 0; i < lht_entries; i++)
   {
-    chooserTable[i] = WEAK_LOCAL;
+    localHistoryTable[i] = 0;
   }
-  
+
   ghr = 0;
 }
 
-uint8_t get_local_prediction(uint32_t bht_local_index)
+uint8_t TournamentPredictor::get_local_prediction(uint32_t bht_local_index)
 {
-  return (bht_local[bht_local_index] >= 4) ? TAKEN : NOTTAKEN;
+  return (bht_local.get(bht_local_index) >= 4) ? TAKEN : NOTTAKEN;
 }
 
-uint8_t get_global_prediction(uint32_t bht_global_index)
+uint8_t TournamentPredictor::get_global_prediction(uint32_t bht_global_index)
 {
-  return (bht_global[bht_global_index] >= 2) ? TAKEN : NOTTAKEN;
+  return (bht_global.get(bht_global_index) >= 2) ? TAKEN : NOTTAKEN;
 }
 
-uint8_t tournament_predict(uint32_t pc)
+void TournamentPredictor::lookup(uint32_t pc, tournament_lookup *l)
 {
   // get lower historyBits of pc, lht and ghr
   int lht_entries = 1 << pcIndexBits;
-  uint32_t lht_index = pc & (lht_entries - 1);
-    
+  l->lht_index = pc & (lht_entries - 1);
+
   // Get local history for this PC
-  uint32_t local_history = localHistoryTable[lht_index] & ((1u << lhistoryBits) - 1);
-  
+  uint32_t local_history = localHistoryTable[l->lht_index] & ((1u << lhistoryBits) - 1);
+
   // Index into bht_local (3-bit counter)
-  uint32_t bht_local_index = local_history;
-  
+  l->bht_local_index = local_history;
+
   // Index into bht_global(2-bit) and Chooser tables(2-bit) using GHR
-  uint32_t bht_global_index = ghr & ((1u << ghistoryBits_tournament) - 1);
+  l->bht_global_index = ghr & ((1u << ghistoryBits_tournament) - 1);
+}
+
+uint32_t TournamentPredictor::predict(uint32_t pc, uint32_t target, uint32_t direct)
+{
+  tournament_lookup l;
+  return predict_state(pc, &l);
+}
+
+size_t TournamentPredictor::state_size()
+{
+  return sizeof(tournament_lookup);
+}
+
+uint32_t TournamentPredictor::predict_state(uint32_t pc, void *state)
+{
+  tournament_lookup *l = (tournament_lookup *)state;
+  lookup(pc, l);
 
-  switch (chooserTable[bht_global_index])
+  switch (chooserTable.get(l->bht_global_index))
   {
       case STRONG_LOCAL:   // 0
       case WEAK_LOCAL:     // 1
-          return get_local_prediction(bht_local_index);
+          return get_local_prediction(l->bht_local_index);
 
       case WEAK_GLOBAL:    // 2
       case STRONG_GLOBAL:  // 3
-          return get_global_prediction(bht_global_index);
+          return get_global_prediction(l->bht_global_index);
 
       default:
           printf("Warning: Undefined state in chooser table!\n");
@@ -255,382 +914,1657 @@ uint8_t tournament_predict(uint32_t pc)
   }
 }
 
-void train_tournament(uint32_t pc, uint8_t outcome)
+void TournamentPredictor::train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
 {
-  // get lower historyBits of pc, lht and ghr
-  int lht_entries = 1 << pcIndexBits;
-  uint32_t lht_index = pc & (lht_entries - 1);
-    
-  // Get local history for this PC
-  uint32_t local_history = localHistoryTable[lht_index] & ((1u << lhistoryBits) - 1);
-  
-  // Index into bht_local (3-bit counter)
-  uint32_t bht_local_index = local_history;
-  
-  // Index into bht_global(2-bit) and Chooser tables(2-bit) using GHR
-  uint32_t bht_global_index = ghr & ((1u << ghistoryBits_tournament) - 1);
+  if (!condition)
+    return;
+
+  tournament_lookup l;
+  lookup(pc, &l);
+  TournamentPredictor::train_state(&l, outcome);
+  TournamentPredictor::shift_history(pc, outcome);
+}
+
+void TournamentPredictor::train_state(const void *state, uint32_t outcome)
+{
+  const tournament_lookup *l = (const tournament_lookup *)state;
+  uint32_t bht_local_index = l->bht_local_index;
+  uint32_t bht_global_index = l->bht_global_index;
 
   uint8_t local_pred = get_local_prediction(bht_local_index);
   uint8_t global_pred = get_global_prediction(bht_global_index);
 
   if (local_pred != global_pred)
   {
-    if (local_pred == outcome && chooserTable[bht_global_index] > STRONG_LOCAL)
-        chooserTable[bht_global_index]--; // favor local
-    else if (global_pred == outcome && chooserTable[bht_global_index] < STRONG_GLOBAL)
-        chooserTable[bht_global_index]++; // favor global
+    if (local_pred == outcome && chooserTable.get(bht_global_index) > STRONG_LOCAL)
+        chooserTable.decrement(bht_global_index); // favor local
+    else if (global_pred == outcome && chooserTable.get(bht_global_index) < STRONG_GLOBAL)
+        chooserTable.increment(bht_global_index); // favor global
   }
 
+  // Counters saturate at STKN/SNTKN and ST/SN
   if (outcome == TAKEN)
-  {
-      if (bht_local[bht_local_index] < STKN) 
-        bht_local[bht_local_index]++;
-  }
+      bht_local.increment(bht_local_index);
   else
-  {
-      if (bht_local[bht_local_index] > SNTKN) 
-        bht_local[bht_local_index]--;
-  }
+      bht_local.decrement(bht_local_index);
 
   if (outcome == TAKEN)
-  {
-      if (bht_global[bht_global_index] < ST) 
-        bht_global[bht_global_index]++;
-  }
+      bht_global.increment(bht_global_index);
   else
-  {
-      if (bht_global[bht_global_index] > SN) 
-        bht_global[bht_global_index]--;
-  }
+      bht_global.decrement(bht_global_index);
+}
 
+void TournamentPredictor::shift_history(uint32_t pc, uint32_t outcome)
+{
+  uint32_t lht_index = pc & ((1u << pcIndexBits) - 1);
   localHistoryTable[lht_index] = ((localHistoryTable[lht_index] << 1) | (outcome & 1)) & ((1u << lhistoryBits) - 1);
   ghr = ((ghr << 1) | (outcome & 1)) & ((1u << ghistoryBits_tournament) - 1);
+}
 
+size_t TournamentPredictor::history_size()
+{
+  return sizeof(tournament_history);
 }
 
-void cleanup_tournament()
+void TournamentPredictor::save_history(uint32_t pc, void *buf)
 {
-  free(localHistoryTable);
-  free(bht_local);
-  free(bht_global);
-  free(chooserTable);
+  tournament_history *h = (tournament_history *)buf;
+  h->ghr = ghr;
+  h->lht_index = pc & ((1u << pcIndexBits) - 1);
+  h->local = localHistoryTable[h->lht_index];
 }
 
-//custom functions
-void init_tage() {
-  base_bht_table = (BaseEntry*)malloc(base_entries * sizeof(BaseEntry));
-  tag_tables = (TaggedEntry**)malloc(num_tag_tables * sizeof(TaggedEntry*));
+void TournamentPredictor::restore_history(const void *buf)
+{
+  const tournament_history *h = (const tournament_history *)buf;
+  ghr = h->ghr;
+  localHistoryTable[h->lht_index] = h->local;
+}
 
-  for (int t = 0; t < num_tag_tables; t++)
-      tag_tables[t] = (TaggedEntry*)malloc(tageTables[t].tableSize * sizeof(TaggedEntry));
+void TournamentPredictor::config_budget(int ghistoryBits, int lhistoryBits, int pcIndexBits, predictor_budget *b)
+{
+  budget_add(b, "Local history table", (1ULL << pcIndexBits) * lhistoryBits, 0);
+  budget_add(b, "Local counters", (1ULL << lhistoryBits) * 3, 0);
+  budget_add(b, "Global counters", (1ULL << ghistoryBits) * 2, 0);
+  budget_add(b, "Chooser", (1ULL << ghistoryBits) * 2, 0);
+  budget_add(b, "Global history", ghistoryBits, 1);
+}
 
-  for (int i = 0; i < base_entries; i++)
-      base_bht_table[i].ctr = 1; // weakly not-taken
+void TournamentPredictor::budget(predictor_budget *b)
+{
+  config_budget(ghistoryBits_tournament, lhistoryBits, pcIndexBits, b);
+}
 
-  for (int t = 0; t < num_tag_tables; t++)
-  {  
-    for (int i = 0; i < tageTables[t].tableSize; i++) 
-    {
-      tag_tables[t][i].valid = 0;
-      tag_tables[t][i].ctr = 4; // weakly not-taken
-      tag_tables[t][i].u = 0;
-      tag_tables[t][i].tag = 0;
-    }
-  }
+void TournamentPredictor::snapshot(snapshot_io *io)
+{
+  snapshot_bytes(io, localHistoryTable, sizeof(uint16_t) << pcIndexBits);
+  snapshot_bytes(io, bht_local.data(), bht_local.size_bytes());
+  snapshot_bytes(io, bht_global.data(), bht_global.size_bytes());
+  snapshot_bytes(io, chooserTable.data(), chooserTable.size_bytes());
+  snapshot_bytes(io, &ghr, sizeof(ghr));
+}
 
-  ghr_custom_1 = 0;
-  ghr_custom_2 = 0;
-  branch_count = 0;
-  last_pred = 0;
-  last_provider = -1;
+uint64_t TournamentPredictor::run_batch(const branch_record *recs, size_t n, int distance, uint8_t *predictions)
+{
+  return run_lookahead<true>(this, recs, n, distance, predictions);
 }
 
-static inline uint32_t fold_history_xor(uint64_t ghr, int hist_len, int out_bits) {
-    // Fold 'hist_len' low bits of ghr into an out_bits-sized value via XOR folding.
-    // out_bits is assumed to be power-of-two width mask size (i.e., tableSize mask bits).
-    uint32_t mask = (1u << out_bits) - 1;
-    uint32_t folded = 0;
-    int i = 0;
-    int pos = 0;
-    while (i < hist_len) {
-        // take up to out_bits bits chunk
-        uint32_t chunk = (uint32_t)((ghr >> i) & mask);
-        folded ^= chunk << pos;
-        // reduce folded to mask
-        folded = (folded & mask) ^ (folded >> out_bits);
-        i += out_bits;
-    }
-    return folded & mask;
+void TournamentPredictor::train_batch(const branch_record *recs, size_t n, int distance)
+{
+  run_lookahead<false>(this, recs, n, distance, NULL);
 }
 
-// Compute index into a table (table->tableSize is power of two)
-uint32_t compute_index(uint32_t pc, const tage_table *table) {
-    uint32_t mask = table->tableSize - 1;
-    uint32_t folded_history = 0;
+size_t TournamentPredictor::lookahead_bytes()
+{
+  return (sizeof(uint16_t) << pcIndexBits) + bht_global.size_bytes() + chooserTable.size_bytes();
+}
 
-    int remaining_bits = table->historyBits;
-    int i = 0;
+void TournamentPredictor::start_lookahead()
+{
+  aheadGhr = ghr;
+}
+
+// The local counter is indexed by a history still to be loaded, so only
+// the local history table and the global tables are prefetched
+void TournamentPredictor::lookahead(const branch_record *r)
+{
+  if (!r->condition)
+    return;
+
+  uint32_t bht_global_index = aheadGhr & ((1u << ghistoryBits_tournament) - 1);
+  __builtin_prefetch(&localHistoryTable[r->pc & ((1u << pcIndexBits) - 1)], 1);
+  bht_global.prefetch(bht_global_index);
+  chooserTable.prefetch(bht_global_index);
+  aheadGhr = ((aheadGhr << 1) | r->outcome) & ((1u << ghistoryBits_tournament) - 1);
+}
+
+TournamentPredictor::~TournamentPredictor()
+{
+  free(localHistoryTable);
+}
 
-    // Fold newer 64 bits
+//custom functions
+// Length of the run of ages that compute_index/compute_tag used to fold
+// from one 64-bit half of the GHR (0 newer, 1 older): the newest
+// 'histBits' bits, split into 'chunkBits'-bit chunks within each half. A
+// chunk starting near bit 64 keeps only the bits below it, yet still
+// counts as a full chunk of the history, so the original loops are
+// replayed to find which bits survive.
+//
+static constexpr int fold_coverage(int histBits, int chunkBits, int half)
+{
+  int remaining_bits = histBits;
+  int covered = 0;
+  for (int h = 0; h <= half; h++)
+  {
+    covered = 0;
+    int i = 0;
     while (remaining_bits > 0 && i < 64) {
-        int bits = (remaining_bits < 32) ? remaining_bits : 32;
-        folded_history ^= (uint32_t)((ghr_custom_2 >> i) & ((1ULL << bits) - 1));
+        int bits = (remaining_bits < chunkBits) ? remaining_bits : chunkBits;
+        covered = (i + bits < 64) ? i + bits : 64;
         i += bits;
         remaining_bits -= bits;
     }
+  }
+  return covered;
+}
 
-    // Fold older 64 bits if needed
-    i = 0;
-    while (remaining_bits > 0 && i < 64) {
-        int bits = (remaining_bits < 32) ? remaining_bits : 32;
-        folded_history ^= (uint32_t)((ghr_custom_1 >> i) & ((1ULL << bits) - 1));
-        i += bits;
-        remaining_bits -= bits;
+// Circular folded history of one table: ages [0, newerLength) at position
+// age % Width, XORed with ages [64, 64 + olderLength) at (age - 64) % Width.
+// Each outcome rotates the register by one, XORs in the bit entering each
+// run and XORs out the bit leaving it.
+template <int HistBits, int ChunkBits, int Width>
+struct fold_kernel
+{
+  static constexpr int newerLength = fold_coverage(HistBits, ChunkBits, 0);
+  static constexpr int olderLength = fold_coverage(HistBits, ChunkBits, 1);
+  static constexpr uint32_t mask = (Width == 32) ? 0xFFFFFFFFu : (1u << Width) - 1;
+
+  // Advance 'comp' by 'outcome', given the GHR halves before the shift
+  static inline uint32_t update(uint32_t comp, uint64_t older, uint64_t newer, uint32_t outcome)
+  {
+    comp = ((comp << 1) | (comp >> (Width - 1))) & mask;
+    comp ^= outcome & 1;
+    comp ^= (uint32_t)((newer >> (newerLength - 1)) & 1) << (newerLength % Width);
+    if (olderLength > 0)
+    {
+      comp ^= (uint32_t)(newer >> 63);
+      comp ^= (uint32_t)((older >> (olderLength - 1)) & 1) << (olderLength % Width);
     }
+    return comp;
+  }
+};
+
+template <int T>
+static inline void update_table_folds(uint32_t *indexFold, uint32_t *tagFold, uint64_t older, uint64_t newer, uint32_t outcome)
+{
+  constexpr tage_table tb = tageTables[T];
+  indexFold[T] = fold_kernel<tb.historyBits, 32, 32>::update(indexFold[T], older, newer, outcome);
+  tagFold[T] = fold_kernel<tb.historyBits, tb.numTagBits, tb.numTagBits>::update(tagFold[T], older, newer, outcome);
+}
+
+// update_table_folds for tables T and up
+template <int T>
+struct fold_tables
+{
+  static inline void update(uint32_t *indexFold, uint32_t *tagFold, uint64_t older, uint64_t newer, uint32_t outcome)
+  {
+    update_table_folds<T>(indexFold, tagFold, older, newer, outcome);
+    fold_tables<T + 1>::update(indexFold, tagFold, older, newer, outcome);
+  }
+};
+
+template <>
+struct fold_tables<num_tag_tables>
+{
+  static inline void update(uint32_t *indexFold, uint32_t *tagFold, uint64_t older, uint64_t newer, uint32_t outcome) {}
+};
 
-    return (pc ^ folded_history) & mask;
+// Match the stored tags at 'entry' against 'want' for every table, four
+// tables per SSE2 compare. Inlined into the lookup, so the lanes are
+// assembled from registers rather than reloaded from memory.
+//
+// Returns the hit mask, bit t set if table t matched
+//
+static inline uint32_t tag_match(const uint16_t *store, const uint32_t *entry, const uint32_t *want)
+{
+  uint32_t hits = 0;
+#if defined(__x86_64__) || defined(__i386__)
+#pragma GCC unroll 4
+  for (int t = 0; t < TAG_LANES; t += 4)
+  {
+    __m128i stored = _mm_set_epi32(store[entry[t + 3]], store[entry[t + 2]],
+                                   store[entry[t + 1]], store[entry[t]]);
+    __m128i wanted = _mm_set_epi32(want[t + 3], want[t + 2], want[t + 1], want[t]);
+    hits |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(stored, wanted))) << t;
   }
+#else
+  for (int t = 0; t < num_tag_tables; t++)
+    hits |= (uint32_t)(store[entry[t]] == want[t]) << t;
+#endif
+  return hits & ((1u << num_tag_tables) - 1);
+}
 
-uint16_t compute_tag(uint32_t pc, const tage_table *table) {
-    uint32_t mask = (1 << table->numTagBits) - 1;
-    uint32_t folded_history = 0;
+TagePredictor::TagePredictor() {
+  base_bht_table.init(base_entries, 1); // weakly not-taken
 
-    int remaining_bits = table->historyBits;
-    int i = 0;
+  tag_store = (uint16_t *)calloc(tageEntries, sizeof(uint16_t)); // all invalid
+  ctr_store.init(tageEntries, 4); // weakly not-taken
+  u_store.init(tageEntries, 0);
 
-    while (remaining_bits > 0 && i < 64) {
-        int bits = (remaining_bits < table->numTagBits) ? remaining_bits : table->numTagBits;
-        folded_history ^= (uint32_t)((ghr_custom_2 >> i) & ((1ULL << bits) - 1));
-        i += bits;
-        remaining_bits -= bits;
-    }
+  ghr_custom_1 = 0;
+  ghr_custom_2 = 0;
+  for (int t = 0; t < num_tag_tables; t++)
+  {
+    indexFold[t] = 0;
+    tagFold[t] = 0;
+  }
 
-    i = 0;
-    while (remaining_bits > 0 && i < 64) {
-        int bits = (remaining_bits < table->numTagBits) ? remaining_bits : table->numTagBits;
-        folded_history ^= (uint32_t)((ghr_custom_1 >> i) & ((1ULL << bits) - 1));
-        i += bits;
-        remaining_bits -= bits;
+  branch_count = 0;
+  last.valid = 0;
+  // Padding lanes never match
+  for (int t = num_tag_tables; t < TAG_LANES; t++)
+  {
+    last.entry[t] = 0;
+    last.want[t] = 0xFFFFFFFF;
+  }
+}
+
+TagePredictor::~TagePredictor() {
+  free(tag_store);
+}
+
+static inline uint32_t fold_history_xor(uint64_t ghr, int hist_len, int out_bits) {
+    // Fold 'hist_len' low bits of ghr into an out_bits-sized value via XOR folding.
+    // out_bits is assumed to be power-of-two width mask size (i.e., tableSize mask bits).
+    uint32_t mask = (1u << out_bits) - 1;
+    uint32_t folded = 0;
+    int i = 0;
+    int pos = 0;
+    while (i < hist_len) {
+        // take up to out_bits bits chunk
+        uint32_t chunk = (uint32_t)((ghr >> i) & mask);
+        folded ^= chunk << pos;
+        // reduce folded to mask
+        folded = (folded & mask) ^ (folded >> out_bits);
+        i += out_bits;
     }
+    return folded & mask;
+}
 
-    return (pc ^ folded_history) & mask;
+// Compute index into a table (table->tableSize is power of two)
+uint32_t TagePredictor::compute_index(uint32_t pc, const tage_table *table) {
+    return (pc ^ indexFold[table - tageTables]) & (table->tableSize - 1);
+}
+
+uint16_t TagePredictor::compute_tag(uint32_t pc, const tage_table *table) {
+    return (pc ^ tagFold[table - tageTables]) & ((1 << table->numTagBits) - 1);
+}
+
+// Advance every folded history by 'outcome'; called before the GHR shift
+void TagePredictor::update_folds(uint32_t outcome) {
+    fold_tables<0>::update(indexFold, tagFold, ghr_custom_1, ghr_custom_2, outcome);
 }
 
 
-uint8_t tage_predict(uint32_t pc) {
-    last_provider = -1;
-    int alt_provider = -1;
+// Look up every table for 'pc' once, leaving the result in 'l'
+void TagePredictor::lookup(uint32_t pc, tage_lookup *l) {
+    l->pc = pc;
+    l->valid = 1;
+    l->baseIndex = pc % base_entries;
 
     // base prediction from base table
-    uint8_t base_taken = (base_bht_table[pc % base_entries].ctr >= 2) ? 1 : 0;
-    uint8_t pred = base_taken;
-    uint8_t altpred = base_taken;
+    uint8_t base_taken = (base_bht_table.get(l->baseIndex) >= 2) ? 1 : 0;
 
-    // scan tag tables from longest history (highest index) to shortest (0)
-    for (int t = num_tag_tables - 1; t >= 0; t--) {
+#pragma GCC unroll 16
+    for (int t = 0; t < num_tag_tables; t++) {
         const struct tage_table *tb = &tageTables[t];
-        uint32_t idx = compute_index(pc, tb);
-        uint16_t tag = compute_tag(pc, tb);
-        TaggedEntry *e = &tag_tables[t][idx];
-        if (e->valid && e->tag == tag) {
-            if (last_provider == -1) {
-                last_provider = t;
-            } else if (alt_provider == -1) {
-                alt_provider = t;
-                // don't break - we may want additional bookkeeping, but two is fine
-            }
-        }
+        l->entry[t] = tage_base(t) + compute_index(pc, tb);
+        l->want[t] = compute_tag(pc, tb) | TAG_VALID;
     }
+    l->hitMask = tag_match(tag_store, l->entry, l->want);
+
+    // provider is the longest history table that matched, alt the next one
+    uint32_t hits = l->hitMask;
+    l->provider = hits ? 31 - __builtin_clz(hits) : -1;
+    if (hits)
+        hits &= ~(1u << l->provider);
+    l->altProvider = hits ? 31 - __builtin_clz(hits) : -1;
 
     // alt_pred: from alt_provider if present, else base
-    if (alt_provider != -1) {
-        const struct tage_table *alt_tb = &tageTables[alt_provider];
-        uint32_t idx_alt = compute_index(pc, alt_tb);
-        TaggedEntry *e_alt = &tag_tables[alt_provider][idx_alt];
-        altpred = (e_alt->ctr >= 4) ? 1 : 0;
+    if (l->altProvider != -1) {
+        l->altpred = (ctr_store.get(l->entry[l->altProvider]) >= 4) ? 1 : 0;
     } else {
-        altpred = base_taken;
+        l->altpred = base_taken;
     }
 
     // provider prediction: if provider exists use its ctr (with usefulness check)
-    if (last_provider != -1) {
-        const struct tage_table *prov_tb = &tageTables[last_provider];
-        uint32_t idx = compute_index(pc, prov_tb);
-        TaggedEntry *prov = &tag_tables[last_provider][idx];
-        uint8_t prov_pred = (prov->ctr >= 4) ? 1 : 0;
+    if (l->provider != -1) {
+        uint32_t prov = l->entry[l->provider];
+        uint8_t prov_ctr = ctr_store.get(prov);
+        uint8_t prov_pred = (prov_ctr >= 4) ? 1 : 0;
 
         // if not useful and weak, use altpred
-        uint8_t weak = (prov->ctr == 3 || prov->ctr == 4);
-        if ((prov->u == 0) && weak) {
-            pred = altpred;
+        uint8_t weak = (prov_ctr == 3 || prov_ctr == 4);
+        if ((u_store.get(prov) == 0) && weak) {
+            l->pred = l->altpred;
         } else {
-            pred = prov_pred;
+            l->pred = prov_pred;
         }
     } else {
-        pred = base_taken;
+        l->pred = base_taken;
     }
+}
 
-    last_pred = pred;
-    return pred;
+uint32_t TagePredictor::predict(uint32_t pc, uint32_t target, uint32_t direct) {
+    lookup(pc, &last);
+    return last.pred;
 }
 
-void allocate_on_mispredict(uint32_t pc, int provider, uint8_t outcome) {
+size_t TagePredictor::state_size() {
+    return sizeof(tage_lookup);
+}
+
+uint32_t TagePredictor::predict_state(uint32_t pc, void *state) {
+    tage_lookup *l = (tage_lookup *)state;
+    // Padding lanes never match
+    for (int t = num_tag_tables; t < TAG_LANES; t++) {
+        l->entry[t] = 0;
+        l->want[t] = 0xFFFFFFFF;
+    }
+    lookup(pc, l);
+    return l->pred;
+}
+
+void TagePredictor::allocate_on_mispredict(const tage_lookup *l, int provider, uint8_t outcome) {
     // Scan from provider-1 downwards to find an entry to allocate (prefer shorter histories)
     for (int t = provider - 1; t >= 0; t--) {
-        const struct tage_table *tb = &tageTables[t];
-        uint32_t idx = compute_index(pc, tb);
-        TaggedEntry *e = &tag_tables[t][idx];
-        if (!e->valid) {
-            // allocate new entry
-            e->valid = 1;
-            e->tag = compute_tag(pc, tb);
+        uint32_t e = l->entry[t];
+        // allocate a new entry, or steal an entry with u==0
+        if (!(tag_store[e] & TAG_VALID) || u_store.get(e) == 0) {
+            tag_store[e] = l->want[t];
             // initialize counter toward the outcome but weakly
-            e->ctr = (outcome == TAKEN) ? 5 : 2; // e.g. weakly taken vs weakly not
-            e->u = 0;
-            return;
-        } else if (e->u == 0) {
-            // steal an entry with u==0
-            e->valid = 1;
-            e->tag = compute_tag(pc, tb);
-            e->ctr = (outcome == TAKEN) ? 5 : 2;
-            e->u = 0;
+            ctr_store.set(e, (outcome == TAKEN) ? 5 : 2); // e.g. weakly taken vs weakly not
+            u_store.set(e, 0);
             return;
         }
     }
     // no allocation possible
 }
 
-void maybe_graceful_u_reset() {
+void TagePredictor::maybe_graceful_u_reset() {
     // Every UGR_PERIOD branches, halve all u counters (right-shift) to decay usefulness.
     if ((branch_count != 0) && ((branch_count % UGR_PERIOD) == 0)) {
-        for (int t = 0; t < num_tag_tables; t++) {
-            for (int i = 0; i < tageTables[t].tableSize; i++) {
-                tag_tables[t][i].u >>= 1;
-            }
+        for (int e = 0; e < tageEntries; e++) {
+            u_store.set(e, u_store.get(e) >> 1);
         }
     }
 }
 
-void train_tage(uint32_t pc, uint8_t outcome) {
+void TagePredictor::train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct) {
+    if (!condition)
+        return;
+
+    // Reuse the lookup of the prediction for this branch
+    if (!last.valid || last.pc != pc)
+        lookup(pc, &last);
+    last.valid = 0;
+
+    TagePredictor::train_state(&last, outcome);
+    TagePredictor::shift_history(pc, outcome);
+}
+
+void TagePredictor::train_state(const void *state, uint32_t outcome) {
+    const tage_lookup *l = (const tage_lookup *)state;
+
     branch_count++;
-    bool base_is_provider = (last_provider == -1);
+    bool base_is_provider = (l->provider == -1);
 
     // Base predictor update
     if (base_is_provider) {
-        uint8_t &base_ctr = base_bht_table[pc % base_entries].ctr;
         if (outcome == TAKEN) {
-            if(base_ctr < 3) base_ctr++;
+            base_bht_table.increment(l->baseIndex);
         } else {
-            if(base_ctr > 0) base_ctr--;
+            base_bht_table.decrement(l->baseIndex);
         }
     }
 
     // Tagged table update
     if (!base_is_provider) {
-        uint8_t altpred;
-        uint32_t idx = compute_index(pc, &tageTables[last_provider]);
-        TaggedEntry &prov = tag_tables[last_provider][idx];
-
-        // Compute alt prediction from lower tables or base
-        altpred = (base_bht_table[pc % base_entries].ctr >= 2) ? 1 : 0;
-        for (int t = last_provider - 1; t >= 0; t--) {
-            uint32_t idx_alt = compute_index(pc, &tageTables[t]);
-            TaggedEntry &e = tag_tables[t][idx_alt];
-            if (e.valid && e.tag == compute_tag(pc, &tageTables[t])) {
-                altpred = (e.ctr >= 4) ? 1 : 0;
-                break;
-            }
-        }
+        uint32_t prov = l->entry[l->provider];
 
-        // Update useful counter
-        if (altpred != last_pred) {
-            if (last_pred == outcome && prov.u < U_MAX) prov.u++;
-            else if (last_pred != outcome && prov.u > U_MIN) prov.u--;
+        // Alt prediction comes from the next matching lower table or base
+        uint8_t altpred = l->altpred;
+
+        // Update useful counter (saturates at U_MIN and U_MAX)
+        if (altpred != l->pred) {
+            if (l->pred == outcome) u_store.increment(prov);
+            else u_store.decrement(prov);
         }
 
         // Update prediction counter
-        if (outcome == TAKEN && prov.ctr < 7) prov.ctr++;
-        else if (outcome == NOTTAKEN && prov.ctr > 0) prov.ctr--;
+        if (outcome == TAKEN) ctr_store.increment(prov);
+        else ctr_store.decrement(prov);
     }
 
     // Allocate on misprediction
-    if (!base_is_provider && outcome != last_pred && last_provider < num_tag_tables - 1)
-        allocate_on_mispredict(pc, last_provider, outcome);
+    if (!base_is_provider && outcome != l->pred && l->provider < num_tag_tables - 1)
+        allocate_on_mispredict(l, l->provider, outcome);
+}
 
-    // Update 128-bit GHR
+void TagePredictor::shift_history(uint32_t pc, uint32_t outcome) {
+    // Update folded histories, then the 128-bit GHR
+    update_folds(outcome);
     uint64_t new_bit = (uint64_t)outcome & 1;
     ghr_custom_1 = (ghr_custom_1 << 1) | (ghr_custom_2 >> 63); // older 64 bits shift in top bit of newer
     ghr_custom_2 = (ghr_custom_2 << 1) | new_bit;               // newer 64 bits shift in new outcome
 }
 
+size_t TagePredictor::history_size() {
+    return sizeof(tage_history);
+}
 
-void init_predictor()
+void TagePredictor::save_history(uint32_t pc, void *buf) {
+    tage_history *h = (tage_history *)buf;
+    h->ghr_custom_1 = ghr_custom_1;
+    h->ghr_custom_2 = ghr_custom_2;
+    memcpy(h->indexFold, indexFold, sizeof(indexFold));
+    memcpy(h->tagFold, tagFold, sizeof(tagFold));
+}
+
+void TagePredictor::restore_history(const void *buf) {
+    const tage_history *h = (const tage_history *)buf;
+    ghr_custom_1 = h->ghr_custom_1;
+    ghr_custom_2 = h->ghr_custom_2;
+    memcpy(indexFold, h->indexFold, sizeof(indexFold));
+    memcpy(tagFold, h->tagFold, sizeof(tagFold));
+}
+
+void TagePredictor::config_budget(predictor_budget *b) {
+    uint64_t tagBits = 0, foldBits = 0;
+    for (int t = 0; t < num_tag_tables; t++) {
+        tagBits += (uint64_t)tageTables[t].tableSize * tageTables[t].numTagBits;
+        foldBits += 32 + tageTables[t].numTagBits;
+    }
+    budget_add(b, "Base counters", base_entries * 2, 0);
+    budget_add(b, "Tags", tagBits, 0);
+    budget_add(b, "Valid bits", tageEntries, 0);
+    budget_add(b, "Tagged counters", tageEntries * 3, 0);
+    budget_add(b, "Useful counters", tageEntries * 2, 0);
+    budget_add(b, "Global history", ghr_bits, 1);
+    budget_add(b, "Folded histories", foldBits, 1);
+    budget_add(b, "Useful reset counter", __builtin_ctzll(UGR_PERIOD), 1);
+}
+
+void TagePredictor::budget(predictor_budget *b) {
+    config_budget(b);
+}
+
+void TagePredictor::snapshot(snapshot_io *io) {
+    snapshot_bytes(io, base_bht_table.data(), base_bht_table.size_bytes());
+    snapshot_bytes(io, tag_store, tageEntries * sizeof(uint16_t));
+    snapshot_bytes(io, ctr_store.data(), ctr_store.size_bytes());
+    snapshot_bytes(io, u_store.data(), u_store.size_bytes());
+    snapshot_bytes(io, &ghr_custom_1, sizeof(ghr_custom_1));
+    snapshot_bytes(io, &ghr_custom_2, sizeof(ghr_custom_2));
+    snapshot_bytes(io, indexFold, sizeof(indexFold));
+    snapshot_bytes(io, tagFold, sizeof(tagFold));
+    snapshot_bytes(io, &branch_count, sizeof(branch_count));
+    last.valid = 0;
+}
+
+uint64_t TagePredictor::run_batch(const branch_record *recs, size_t n, int distance, uint8_t *predictions) {
+    return run_lookahead<true>(this, recs, n, distance, predictions);
+}
+
+void TagePredictor::train_batch(const branch_record *recs, size_t n, int distance) {
+    run_lookahead<false>(this, recs, n, distance, NULL);
+}
+
+size_t TagePredictor::lookahead_bytes() {
+    return tageEntries * sizeof(uint16_t) + ctr_store.size_bytes() + u_store.size_bytes() + base_bht_table.size_bytes();
+}
+
+void TagePredictor::start_lookahead() {
+    save_history(0, &ahead);
+}
+
+void TagePredictor::lookahead(const branch_record *r) {
+    if (!r->condition)
+        return;
+
+    base_bht_table.prefetch(r->pc % base_entries);
+    for (int t = 0; t < num_tag_tables; t++) {
+        uint32_t e = tage_base(t) + ((r->pc ^ ahead.indexFold[t]) & (tageTables[t].tableSize - 1));
+        __builtin_prefetch(&tag_store[e], 1);
+        ctr_store.prefetch(e);
+        u_store.prefetch(e);
+    }
+
+    // Advance the copy as shift_history() does
+    fold_tables<0>::update(ahead.indexFold, ahead.tagFold, ahead.ghr_custom_1, ahead.ghr_custom_2, r->outcome);
+    ahead.ghr_custom_1 = (ahead.ghr_custom_1 << 1) | (ahead.ghr_custom_2 >> 63);
+    ahead.ghr_custom_2 = (ahead.ghr_custom_2 << 1) | (r->outcome & 1);
+}
+
+// tage-sc-l functions
+
+// Storage of the fixed-size components, in bits
+#define TSL_BASE_BITS ((1 << TSL_LOG_BASE) * 2)
+#define TSL_SC_BITS (TSL_SC_TABLES * (1 << TSL_LOG_SC) * TSL_SC_CTR_BITS)
+#define TSL_LOOP_ENTRY_BITS (TSL_LOOP_TAG_BITS + 2 * TSL_LOOP_ITER_BITS + 2 + 3 + 1)
+#define TSL_LOOP_BITS (TSL_LOOP_ENTRIES * TSL_LOOP_ENTRY_BITS)
+
+// A tagged entry is a 3-bit counter, a 2-bit usefulness counter, a tag
+// and the TAG_VALID bit marking it filled
+#define TSL_ENTRY_BITS(tagBits) (3 + 2 + (tagBits) + 1)
+
+// History lengths of the statistical corrector; table 0 is the bias table
+static const int scHistLength[TSL_SC_TABLES] = {0, 4, 9, 16, 27};
+
+// History lengths form a geometric series from minHistory to maxHistory,
+// and tags widen from the shortest to the longest. The tagged tables
+// share what the base, loop and corrector tables leave of the budget:
+// every table gets the largest common size that fits, then the shortest
+// history tables double while they still fit. Returns the number of
+// tables.
+int TageSclPredictor::size_tables(int numComponents, int minHistory, int maxHistory, int *histLength, int *tagBits,
+                                  int *logEntries)
+{
+  int numTables = numComponents;
+  if (maxHistory < minHistory + numTables)
+    maxHistory = minHistory + numTables;
+  for (int t = 0; t < numTables; t++)
+  {
+    double r = (numTables > 1) ? (double)t / (numTables - 1) : 0;
+    histLength[t] = (int)(minHistory * pow((double)maxHistory / minHistory, r) + 0.5);
+    if (t > 0 && histLength[t] <= histLength[t - 1])
+      histLength[t] = histLength[t - 1] + 1;
+    tagBits[t] = TSL_MIN_TAG_BITS;
+    if (numTables > 1)
+      tagBits[t] += t * (TSL_MAX_TAG_BITS - TSL_MIN_TAG_BITS) / (numTables - 1);
+  }
+
+  int budget = BUDGET_TABLE_BITS - TSL_BASE_BITS - TSL_SC_BITS - TSL_LOOP_BITS;
+  int used = 0;
+  for (int log = 1;; log++)
+  {
+    int bits = 0;
+    for (int t = 0; t < numTables; t++)
+      bits += (1 << log) * TSL_ENTRY_BITS(tagBits[t]);
+    if (bits > budget)
+      break;
+    used = bits;
+    for (int t = 0; t < numTables; t++)
+      logEntries[t] = log;
+  }
+  for (int t = 0; t < numTables; t++)
+  {
+    int more = (1 << logEntries[t]) * TSL_ENTRY_BITS(tagBits[t]);
+    if (used + more <= budget)
+    {
+      used += more;
+      logEntries[t]++;
+    }
+  }
+  return numTables;
+}
+
+TageSclPredictor::TageSclPredictor(int numComponents, int minHistory, int maxHistory)
+{
+  numTables = size_tables(numComponents, minHistory, maxHistory, histLength, tagBits, logEntries);
+  base_bht_table.init(1 << TSL_LOG_BASE, WN);
+  for (int t = 0; t < numTables; t++)
+  {
+    int entries = 1 << logEntries[t];
+    tags[t] = (uint16_t *)calloc(entries, sizeof(uint16_t)); // all invalid
+    ctr[t].init(entries, 3); // weakly not-taken
+    u[t].init(entries, 0);
+    indexFold[t].init(histLength[t], logEntries[t]);
+    tagFold0[t].init(histLength[t], tagBits[t]);
+    tagFold1[t].init(histLength[t], tagBits[t] - 1);
+  }
+  useAltOnNa = 0;
+  branch_count = 0;
+
+  memset(loops, 0, sizeof(loops));
+  withLoop = -1;
+
+  for (int j = 0; j < TSL_SC_TABLES; j++)
+    sc[j] = (int8_t *)calloc(1 << TSL_LOG_SC, sizeof(int8_t));
+  scThreshold = 12;
+  scTc = 0;
+
+  memset(histBuf, 0, sizeof(histBuf));
+  histPos = TSL_HIST_BUF - (histLength[numTables - 1] + 1);
+  shifts = 0;
+  ghist = 0;
+  phist = 0;
+  seed = 0x2545F491;
+  last.valid = 0;
+}
+
+TageSclPredictor::~TageSclPredictor()
+{
+  for (int t = 0; t < numTables; t++)
+    free(tags[t]);
+  for (int j = 0; j < TSL_SC_TABLES; j++)
+    free(sc[j]);
+}
+
+// xorshift, so allocation choices repeat from run to run
+uint32_t TageSclPredictor::random()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+void TageSclPredictor::loop_lookup(uint32_t pc, tagescl_lookup *l)
+{
+  l->loopIndex = pc & (TSL_LOOP_ENTRIES - 1);
+  const loop_entry *e = &loops[l->loopIndex];
+  uint16_t tag = (pc >> 5) & ((1 << TSL_LOOP_TAG_BITS) - 1);
+
+  l->loopHit = (e->tag == tag && e->age > 0);
+  l->loopValid = l->loopHit && e->conf == TSL_LOOP_CONF_MAX && e->pastIter > 0;
+  l->loopPred = (e->curIter + 1 == e->pastIter) ? !e->dir : e->dir;
+}
+
+// The bias table is indexed by the prediction the corrector checks and
+// its confidence, the GEHL tables by PC and global history
+void TageSclPredictor::sc_lookup(uint32_t pc, tagescl_lookup *l)
+{
+  uint32_t mask = (1 << TSL_LOG_SC) - 1;
+  l->scIndex[0] = (((pc ^ (pc >> (TSL_LOG_SC - 2))) << 2) | (l->preScPred << 1) | l->highConf) & mask;
+  for (int j = 1; j < TSL_SC_TABLES; j++)
+  {
+    uint64_t h = (ghist & ((1ULL << scHistLength[j]) - 1)) * 0x9E3779B97F4A7C15ULL;
+    l->scIndex[j] = (pc ^ (pc >> TSL_LOG_SC) ^ (uint32_t)(h >> 40)) & mask;
+  }
+
+  l->scSum = 0;
+  for (int j = 0; j < TSL_SC_TABLES; j++)
+    l->scSum += 2 * sc[j][l->scIndex[j]] + 1;
+}
+
+// Look up every component for 'pc' once, leaving the result in 'l'
+void TageSclPredictor::lookup(uint32_t pc, tagescl_lookup *l)
+{
+  l->pc = pc;
+  l->valid = 1;
+  l->baseIndex = pc & ((1 << TSL_LOG_BASE) - 1);
+
+  // provider is the longest history table that matched, alt the next one
+  l->provider = -1;
+  l->altProvider = -1;
+  for (int t = numTables - 1; t >= 0; t--)
+  {
+    int log = logEntries[t];
+    uint32_t path = phist & ((1u << ((histLength[t] < TSL_PHIST_BITS) ? histLength[t] : TSL_PHIST_BITS)) - 1);
+    l->index[t] = (pc ^ (pc >> log) ^ indexFold[t].comp ^ path ^ (path >> log)) & ((1 << log) - 1);
+    l->tag[t] = ((pc ^ tagFold0[t].comp ^ (tagFold1[t].comp << 1)) & ((1 << tagBits[t]) - 1)) | TAG_VALID;
+    if (tags[t][l->index[t]] == l->tag[t])
+    {
+      if (l->provider < 0)
+        l->provider = t;
+      else if (l->altProvider < 0)
+        l->altProvider = t;
+    }
+  }
+
+  uint8_t baseCtr = base_bht_table.get(l->baseIndex);
+  uint8_t basePred = (baseCtr >= WT) ? TAKEN : NOTTAKEN;
+  if (l->altProvider >= 0)
+    l->altpred = (ctr[l->altProvider].get(l->index[l->altProvider]) >= 4) ? TAKEN : NOTTAKEN;
+  else
+    l->altpred = basePred;
+
+  if (l->provider >= 0)
+  {
+    int p = l->provider;
+    uint8_t c = ctr[p].get(l->index[p]);
+    l->providerPred = (c >= 4) ? TAKEN : NOTTAKEN;
+    l->newEntry = (c == 3 || c == 4) && u[p].get(l->index[p]) == 0;
+    l->tagePred = (l->newEntry && useAltOnNa >= 0) ? l->altpred : l->providerPred;
+    l->highConf = (c == 0 || c == 7);
+  }
+  else
+  {
+    l->providerPred = basePred;
+    l->newEntry = 0;
+    l->tagePred = basePred;
+    l->highConf = (baseCtr == SN || baseCtr == ST);
+  }
+
+  // A confident loop overrides TAGE, and the corrector leaves it alone
+  loop_lookup(pc, l);
+  int useLoop = l->loopValid && withLoop >= 0;
+  l->preScPred = useLoop ? l->loopPred : l->tagePred;
+
+  sc_lookup(pc, l);
+  l->pred = l->preScPred;
+  uint8_t scPred = (l->scSum >= 0) ? TAKEN : NOTTAKEN;
+  if (!useLoop && scPred != l->preScPred && abs(l->scSum) >= (l->highConf ? scThreshold : scThreshold / 2))
+    l->pred = scPred;
+}
+
+uint32_t TageSclPredictor::predict(uint32_t pc, uint32_t target, uint32_t direct)
+{
+  lookup(pc, &last);
+  return last.pred;
+}
+
+size_t TageSclPredictor::state_size()
+{
+  return sizeof(tagescl_lookup);
+}
+
+uint32_t TageSclPredictor::predict_state(uint32_t pc, void *state)
+{
+  tagescl_lookup *l = (tagescl_lookup *)state;
+  lookup(pc, l);
+  return l->pred;
+}
+
+void TageSclPredictor::tage_update(const tagescl_lookup *l, uint32_t outcome)
+{
+  int p = l->provider;
+
+  // Allocate on misprediction in one longer table with a free entry,
+  // skipping a table at random to spread allocations; age the
+  // candidates when none is free
+  int alloc = (l->tagePred != outcome) && p < numTables - 1;
+  if (p >= 0 && l->newEntry && l->providerPred == outcome)
+    alloc = 0;
+  if (alloc)
+  {
+    int start = p + 1;
+    if (start < numTables - 1 && (random() & 1))
+      start++;
+    int t;
+    for (t = start; t < numTables; t++)
+    {
+      if (u[t].get(l->index[t]) == 0)
+      {
+        tags[t][l->index[t]] = l->tag[t];
+        ctr[t].set(l->index[t], (outcome == TAKEN) ? 4 : 3);
+        break;
+      }
+    }
+    if (t == numTables)
+    {
+      for (t = start; t < numTables; t++)
+        u[t].decrement(l->index[t]);
+    }
+  }
+
+  if (p >= 0)
+  {
+    uint32_t e = l->index[p];
+
+    // Learn whether new entries are worse than the alternate prediction
+    if (l->newEntry && l->providerPred != l->altpred)
+    {
+      if (l->altpred == outcome && useAltOnNa < 7)
+        useAltOnNa++;
+      else if (l->altpred != outcome && useAltOnNa > -8)
+        useAltOnNa--;
+    }
+
+    // An entry that is not yet useful also trains the alternate
+    if (u[p].get(e) == 0)
+    {
+      if (l->altProvider >= 0)
+      {
+        if (outcome == TAKEN)
+          ctr[l->altProvider].increment(l->index[l->altProvider]);
+        else
+          ctr[l->altProvider].decrement(l->index[l->altProvider]);
+      }
+      else
+      {
+        if (outcome == TAKEN)
+          base_bht_table.increment(l->baseIndex);
+        else
+          base_bht_table.decrement(l->baseIndex);
+      }
+    }
+
+    if (outcome == TAKEN)
+      ctr[p].increment(e);
+    else
+      ctr[p].decrement(e);
+
+    if (l->providerPred != l->altpred)
+    {
+      if (l->providerPred == outcome)
+        u[p].increment(e);
+      else
+        u[p].decrement(e);
+    }
+  }
+  else
+  {
+    if (outcome == TAKEN)
+      base_bht_table.increment(l->baseIndex);
+    else
+      base_bht_table.decrement(l->baseIndex);
+  }
+
+  // Every UGR_PERIOD branches, halve all u counters to decay usefulness
+  branch_count++;
+  if ((branch_count % UGR_PERIOD) == 0)
+  {
+    for (int t = 0; t < numTables; t++)
+      for (uint32_t e = 0; e < (1u << logEntries[t]); e++)
+        u[t].set(e, u[t].get(e) >> 1);
+  }
+}
+
+void TageSclPredictor::loop_update(const tagescl_lookup *l, uint32_t outcome)
+{
+  loop_entry *e = &loops[l->loopIndex];
+
+  if (l->loopValid && l->loopPred != l->tagePred)
+  {
+    if (l->loopPred == outcome && withLoop < 63)
+      withLoop++;
+    else if (l->loopPred != outcome && withLoop > -64)
+      withLoop--;
+  }
+
+  if (l->loopHit)
+  {
+    if (l->loopValid)
+    {
+      // A confident loop that mispredicts is freed
+      if (l->loopPred != outcome)
+      {
+        memset(e, 0, sizeof(*e));
+        return;
+      }
+      if (l->loopPred != l->tagePred && e->age < TSL_LOOP_AGE_MAX)
+        e->age++;
+    }
+
+    e->curIter++;
+    if (e->curIter >= (1 << TSL_LOOP_ITER_BITS))
+    {
+      memset(e, 0, sizeof(*e));
+      return;
+    }
+    // Loop exit: confident once trips repeat the same count
+    if (outcome != e->dir)
+    {
+      if (e->curIter == e->pastIter)
+      {
+        if (e->conf < TSL_LOOP_CONF_MAX)
+          e->conf++;
+      }
+      else
+      {
+        e->pastIter = e->curIter;
+        e->conf = 0;
+      }
+      e->curIter = 0;
+    }
+  }
+  else if (l->tagePred != outcome)
+  {
+    // Allocate, taking this mispredicted outcome as the loop exit
+    if (e->age == 0)
+    {
+      e->tag = (l->pc >> 5) & ((1 << TSL_LOOP_TAG_BITS) - 1);
+      e->pastIter = 0;
+      e->curIter = 0;
+      e->conf = 0;
+      e->age = TSL_LOOP_AGE_MAX;
+      e->dir = !outcome;
+    }
+    else
+      e->age--;
+  }
+}
+
+// O-GEHL style: train while wrong or below the threshold, and move the
+// threshold so both happen about equally often
+void TageSclPredictor::sc_update(const tagescl_lookup *l, uint32_t outcome)
+{
+  uint8_t scPred = (l->scSum >= 0) ? TAKEN : NOTTAKEN;
+  int maxCtr = (1 << (TSL_SC_CTR_BITS - 1)) - 1;
+
+  if (scPred != outcome || abs(l->scSum) < scThreshold)
+  {
+    for (int j = 0; j < TSL_SC_TABLES; j++)
+    {
+      int8_t &c = sc[j][l->scIndex[j]];
+      if (outcome == TAKEN && c < maxCtr)
+        c++;
+      else if (outcome == NOTTAKEN && c > -maxCtr - 1)
+        c--;
+    }
+  }
+
+  if (scPred != outcome)
+  {
+    if (++scTc >= 32)
+    {
+      scThreshold++;
+      scTc = 0;
+    }
+  }
+  else if (abs(l->scSum) < scThreshold)
+  {
+    if (--scTc <= -32)
+    {
+      scThreshold--;
+      scTc = 0;
+    }
+  }
+}
+
+// Shift 'outcome' into the global and path histories and every folded
+// history. The window slides down histBuf and is copied back to the top
+// when it reaches the bottom, with room for restore_history() to move it
+// back up.
+void TageSclPredictor::shift_history(uint32_t pc, uint32_t outcome)
+{
+  if (histPos == 0)
+  {
+    int window = histLength[numTables - 1] + 1 + HISTORY_REPAIR_MAX;
+    histPos = TSL_HIST_BUF - window;
+    memmove(histBuf + histPos, histBuf, window);
+  }
+  histBuf[--histPos] = outcome;
+  shifts++;
+
+  const uint8_t *h = histBuf + histPos;
+  for (int t = 0; t < numTables; t++)
+  {
+    indexFold[t].update(h);
+    tagFold0[t].update(h);
+    tagFold1[t].update(h);
+  }
+  ghist = (ghist << 1) | outcome;
+  phist = ((phist << 1) ^ ((pc ^ (pc >> 4)) & 1)) & ((1u << TSL_PHIST_BITS) - 1);
+}
+
+size_t TageSclPredictor::history_size()
+{
+  return sizeof(tagescl_history);
+}
+
+void TageSclPredictor::save_history(uint32_t pc, void *buf)
+{
+  tagescl_history *h = (tagescl_history *)buf;
+  h->shifts = shifts;
+  h->ghist = ghist;
+  h->phist = phist;
+  for (int t = 0; t < numTables; t++)
+  {
+    h->indexComp[t] = indexFold[t].comp;
+    h->tagComp0[t] = tagFold0[t].comp;
+    h->tagComp1[t] = tagFold1[t].comp;
+  }
+}
+
+void TageSclPredictor::restore_history(const void *buf)
+{
+  const tagescl_history *h = (const tagescl_history *)buf;
+  histPos += (int)(shifts - h->shifts);
+  shifts = h->shifts;
+  ghist = h->ghist;
+  phist = h->phist;
+  for (int t = 0; t < numTables; t++)
+  {
+    indexFold[t].comp = h->indexComp[t];
+    tagFold0[t].comp = h->tagComp0[t];
+    tagFold1[t].comp = h->tagComp1[t];
+  }
+}
+
+// The folded histories are as wide as the index and the two tag folds
+void TageSclPredictor::config_budget(int numTables, const int *histLength, const int *tagBits, const int *logEntries,
+                                     predictor_budget *b)
+{
+  uint64_t entries = 0, tagTotal = 0, foldBits = 0;
+  for (int t = 0; t < numTables; t++)
+  {
+    entries += 1ULL << logEntries[t];
+    tagTotal += (1ULL << logEntries[t]) * tagBits[t];
+    foldBits += logEntries[t] + tagBits[t] + (tagBits[t] - 1);
+  }
+  budget_add(b, "Base counters", TSL_BASE_BITS, 0);
+  budget_add(b, "Tags", tagTotal, 0);
+  budget_add(b, "Valid bits", entries, 0);
+  budget_add(b, "Tagged counters", entries * 3, 0);
+  budget_add(b, "Useful counters", entries * 2, 0);
+  budget_add(b, "Loop predictor", TSL_LOOP_BITS, 0);
+  budget_add(b, "Statistical corrector", TSL_SC_BITS, 0);
+  budget_add(b, "Global history", histLength[numTables - 1], 1);
+  budget_add(b, "Path history", TSL_PHIST_BITS, 1);
+  budget_add(b, "Folded histories", foldBits, 1);
+  // useAltOnNa, withLoop, the corrector threshold and its counter
+  budget_add(b, "Choosers and threshold", 4 + 7 + 8 + 6, 1);
+  budget_add(b, "Useful reset counter", __builtin_ctzll(UGR_PERIOD), 1);
+  budget_add(b, "Allocation LFSR", 32, 1);
+}
+
+void TageSclPredictor::budget(predictor_budget *b)
+{
+  config_budget(numTables, histLength, tagBits, logEntries, b);
+}
+
+void TageSclPredictor::snapshot(snapshot_io *io)
+{
+  snapshot_bytes(io, base_bht_table.data(), base_bht_table.size_bytes());
+  for (int t = 0; t < numTables; t++)
+  {
+    snapshot_bytes(io, tags[t], sizeof(uint16_t) << logEntries[t]);
+    snapshot_bytes(io, ctr[t].data(), ctr[t].size_bytes());
+    snapshot_bytes(io, u[t].data(), u[t].size_bytes());
+    snapshot_bytes(io, &indexFold[t].comp, sizeof(uint32_t));
+    snapshot_bytes(io, &tagFold0[t].comp, sizeof(uint32_t));
+    snapshot_bytes(io, &tagFold1[t].comp, sizeof(uint32_t));
+  }
+  snapshot_bytes(io, &useAltOnNa, sizeof(useAltOnNa));
+  snapshot_bytes(io, &branch_count, sizeof(branch_count));
+  snapshot_bytes(io, loops, sizeof(loops));
+  snapshot_bytes(io, &withLoop, sizeof(withLoop));
+  for (int j = 0; j < TSL_SC_TABLES; j++)
+    snapshot_bytes(io, sc[j], 1 << TSL_LOG_SC);
+  snapshot_bytes(io, &scThreshold, sizeof(scThreshold));
+  snapshot_bytes(io, &scTc, sizeof(scTc));
+  snapshot_bytes(io, histBuf, sizeof(histBuf));
+  snapshot_bytes(io, &histPos, sizeof(histPos));
+  snapshot_bytes(io, &shifts, sizeof(shifts));
+  snapshot_bytes(io, &ghist, sizeof(ghist));
+  snapshot_bytes(io, &phist, sizeof(phist));
+  snapshot_bytes(io, &seed, sizeof(seed));
+  last.valid = 0;
+}
+
+void TageSclPredictor::train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  if (!condition)
+    return;
+
+  // Reuse the lookup of the prediction for this branch
+  if (!last.valid || last.pc != pc)
+    lookup(pc, &last);
+  last.valid = 0;
+
+  TageSclPredictor::train_state(&last, outcome);
+  TageSclPredictor::shift_history(pc, outcome);
+}
+
+// A loop entry counts its iterations here, so with several branches in
+// flight a lookup sees the count as of the last resolved branch
+void TageSclPredictor::train_state(const void *state, uint32_t outcome)
+{
+  const tagescl_lookup *l = (const tagescl_lookup *)state;
+  sc_update(l, outcome);
+  loop_update(l, outcome);
+  tage_update(l, outcome);
+}
+
+// perceptron functions
+
+// Portable kernels
+static int perceptron_dot_scalar(int8_t *const *rows, const int8_t *hist, int tables, int segLen, int lanes)
+{
+  int y = 0;
+  for (int t = 0; t < tables; t++)
+  {
+    const int8_t *h = hist + t * segLen;
+    for (int k = 0; k < lanes; k++)
+      y += (rows[t][k] ^ h[k]) - h[k];
+  }
+  return y;
+}
+
+static void perceptron_update_scalar(int8_t *const *rows, const int8_t *hist, const int8_t *laneMask,
+                                     int tables, int segLen, int lanes, int8_t outcomeMask)
+{
+  for (int t = 0; t < tables; t++)
+  {
+    const int8_t *h = hist + t * segLen;
+    const int8_t *lm = laneMask + t * lanes;
+    for (int k = 0; k < lanes; k++)
+    {
+      int w = rows[t][k] + (((h[k] ^ outcomeMask) | 1) & lm[k]);
+      rows[t][k] = (w > 127) ? 127 : (w < -127) ? -127 : w;
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// SSE2 kernels, 16 weights per vector. The signed products are biased to
+// unsigned bytes so _mm_sad_epu8 can sum them.
+static int perceptron_dot_sse2(int8_t *const *rows, const int8_t *hist, int tables, int segLen, int lanes)
+{
+  const __m128i bias = _mm_set1_epi8((char)0x80);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = _mm_setzero_si128();
+  for (int t = 0; t < tables; t++)
+  {
+    const int8_t *h = hist + t * segLen;
+    for (int k = 0; k < lanes; k += 16)
+    {
+      __m128i w = _mm_load_si128((const __m128i *)(rows[t] + k));
+      __m128i m = _mm_loadu_si128((const __m128i *)(h + k));
+      __m128i c = _mm_sub_epi8(_mm_xor_si128(w, m), m);
+      acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_xor_si128(c, bias), zero));
+    }
+  }
+  acc = _mm_add_epi64(acc, _mm_srli_si128(acc, 8));
+  return _mm_cvtsi128_si32(acc) - 128 * tables * lanes;
+}
+
+// Saturating add of +1/-1 per weight, kept within [-127, 127] so every
+// weight can be negated
+static void perceptron_update_sse2(int8_t *const *rows, const int8_t *hist, const int8_t *laneMask,
+                                   int tables, int segLen, int lanes, int8_t outcomeMask)
+{
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i min = _mm_set1_epi8(-128);
+  const __m128i om = _mm_set1_epi8(outcomeMask);
+  for (int t = 0; t < tables; t++)
+  {
+    const int8_t *h = hist + t * segLen;
+    const int8_t *lm = laneMask + t * lanes;
+    for (int k = 0; k < lanes; k += 16)
+    {
+      __m128i *row = (__m128i *)(rows[t] + k);
+      __m128i m = _mm_loadu_si128((const __m128i *)(h + k));
+      __m128i delta = _mm_and_si128(_mm_or_si128(_mm_xor_si128(m, om), one),
+                                    _mm_load_si128((const __m128i *)(lm + k)));
+      __m128i w = _mm_adds_epi8(_mm_load_si128(row), delta);
+      _mm_store_si128(row, _mm_sub_epi8(w, _mm_cmpeq_epi8(w, min)));
+    }
+  }
+}
+
+// AVX2 kernels, 32 weights per vector with a 16 weight tail
+__attribute__((target("avx2")))
+static int perceptron_dot_avx2(int8_t *const *rows, const int8_t *hist, int tables, int segLen, int lanes)
+{
+  const __m256i bias = _mm256_set1_epi8((char)0x80);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc = _mm256_setzero_si256();
+  for (int t = 0; t < tables; t++)
+  {
+    const int8_t *h = hist + t * segLen;
+    int k = 0;
+    for (; k + 32 <= lanes; k += 32)
+    {
+      __m256i w = _mm256_loadu_si256((const __m256i *)(rows[t] + k));
+      __m256i m = _mm256_loadu_si256((const __m256i *)(h + k));
+      __m256i c = _mm256_sub_epi8(_mm256_xor_si256(w, m), m);
+      acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_xor_si256(c, bias), zero));
+    }
+    if (k < lanes)
+    {
+      __m128i w = _mm_load_si128((const __m128i *)(rows[t] + k));
+      __m128i m = _mm_loadu_si128((const __m128i *)(h + k));
+      __m128i c = _mm_sub_epi8(_mm_xor_si128(w, m), m);
+      __m128i s = _mm_sad_epu8(_mm_xor_si128(c, _mm256_castsi256_si128(bias)), _mm_setzero_si128());
+      acc = _mm256_add_epi64(acc, _mm256_zextsi128_si256(s));
+    }
+  }
+  __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  sum = _mm_add_epi64(sum, _mm_srli_si128(sum, 8));
+  return _mm_cvtsi128_si32(sum) - 128 * tables * lanes;
+}
+
+__attribute__((target("avx2")))
+static void perceptron_update_avx2(int8_t *const *rows, const int8_t *hist, const int8_t *laneMask,
+                                   int tables, int segLen, int lanes, int8_t outcomeMask)
+{
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i min = _mm256_set1_epi8(-128);
+  const __m256i om = _mm256_set1_epi8(outcomeMask);
+  for (int t = 0; t < tables; t++)
+  {
+    const int8_t *h = hist + t * segLen;
+    const int8_t *lm = laneMask + t * lanes;
+    int k = 0;
+    for (; k + 32 <= lanes; k += 32)
+    {
+      __m256i *row = (__m256i *)(rows[t] + k);
+      __m256i m = _mm256_loadu_si256((const __m256i *)(h + k));
+      __m256i delta = _mm256_and_si256(_mm256_or_si256(_mm256_xor_si256(m, om), one),
+                                       _mm256_loadu_si256((const __m256i *)(lm + k)));
+      __m256i w = _mm256_adds_epi8(_mm256_loadu_si256(row), delta);
+      _mm256_storeu_si256(row, _mm256_sub_epi8(w, _mm256_cmpeq_epi8(w, min)));
+    }
+    if (k < lanes)
+    {
+      __m128i *row = (__m128i *)(rows[t] + k);
+      __m128i m = _mm_loadu_si128((const __m128i *)(h + k));
+      __m128i delta = _mm_and_si128(_mm_or_si128(_mm_xor_si128(m, _mm256_castsi256_si128(om)), _mm256_castsi256_si128(one)),
+                                    _mm_load_si128((const __m128i *)(lm + k)));
+      __m128i w = _mm_adds_epi8(_mm_load_si128(row), delta);
+      _mm_store_si128(row, _mm_sub_epi8(w, _mm_cmpeq_epi8(w, _mm256_castsi256_si128(min))));
+    }
+  }
+}
+#endif
+
+// The weights fill the table budget, less the bias table, with a power
+// of two rows per table. A row of every table together holds one weight
+// per history bit; padding lanes are not counted. The history is the
+// only register counted against the register budget.
+int PerceptronPredictor::row_bits(int historyLength)
+{
+  int weightBudget = BUDGET_TABLE_BITS - 8 * PERCEPTRON_BIAS_ENTRIES;
+  int rowBits = 0;
+  while (((2 << rowBits) * historyLength * 8) <= weightBudget)
+    rowBits++;
+  return rowBits;
+}
+
+PerceptronPredictor::PerceptronPredictor(int historyLength, int numTables)
+{
+  segLen = (historyLength + numTables - 1) / numTables;
+  numTables = (historyLength + segLen - 1) / segLen; // Drop tables left without history
+  this->historyLength = historyLength;
+  this->numTables = numTables;
+  lanes = (segLen + PERCEPTRON_LANES - 1) & ~(PERCEPTRON_LANES - 1);
+
+  rowBits = row_bits(historyLength);
+  threshold = (int)(1.93 * historyLength + 14);
+
+  size_t weightBytes = ((size_t)numTables << rowBits) * lanes;
+  weights = (int8_t *)aligned_alloc(32, (weightBytes + 31) & ~(size_t)31);
+  memset(weights, 0, weightBytes);
+  laneMask = (int8_t *)aligned_alloc(32, (numTables * lanes + 31) & ~31);
+  for (int t = 0; t < numTables; t++)
+  {
+    int real = historyLength - t * segLen;
+    if (real > segLen)
+      real = segLen;
+    for (int k = 0; k < lanes; k++)
+      laneMask[t * lanes + k] = (k < real) ? -1 : 0;
+  }
+  memset(bias, 0, sizeof(bias));
+  for (int t = 0; t < numTables; t++)
+  {
+    int len = t * segLen;
+    histMask[t] = (len >= 64) ? ~0ULL : (1ULL << len) - 1;
+  }
+
+  // All not taken
+  memset(histBuf, -1, sizeof(histBuf));
+  histPos = PERCEPTRON_HIST_BUF - ((numTables - 1) * segLen + lanes);
+  shifts = 0;
+  ghist = 0;
+
+  dot = perceptron_dot_scalar;
+  update = perceptron_update_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2"))
+  {
+    dot = perceptron_dot_avx2;
+    update = perceptron_update_avx2;
+  }
+  else
+  {
+    dot = perceptron_dot_sse2;
+    update = perceptron_update_sse2;
+  }
+#endif
+  last.valid = 0;
+}
+
+PerceptronPredictor::~PerceptronPredictor()
+{
+  free(weights);
+  free(laneMask);
+}
+
+// Table 0 is indexed by the PC alone; every later table also hashes in
+// the history older than its segment's start
+void PerceptronPredictor::lookup(uint32_t pc, perceptron_lookup *l)
+{
+  l->pc = pc;
+  l->valid = 1;
+  l->biasIndex = pc % PERCEPTRON_BIAS_ENTRIES;
+
+  uint32_t rowMask = (1u << rowBits) - 1;
+  uint32_t pcHash = pc ^ (pc >> rowBits);
+  for (int t = 0; t < numTables; t++)
+  {
+    // Multiplicative hash of the older history, its top bits taken
+    uint64_t h = (ghist & histMask[t]) * 0x9E3779B97F4A7C15ULL;
+    uint32_t row = (pcHash ^ (uint32_t)(h >> 40)) & rowMask;
+    l->rows[t] = weights + (((size_t)t << rowBits) + row) * lanes;
+  }
+  l->y = bias[l->biasIndex] + dot(l->rows, histBuf + histPos, numTables, segLen, lanes);
+}
+
+uint32_t PerceptronPredictor::predict(uint32_t pc, uint32_t target, uint32_t direct)
+{
+  lookup(pc, &last);
+  return (last.y >= 0) ? TAKEN : NOTTAKEN;
+}
+
+size_t PerceptronPredictor::state_size()
+{
+  return sizeof(perceptron_state);
+}
+
+// The history window is copied out with the rows, as the update must
+// see the history the prediction was made with
+uint32_t PerceptronPredictor::predict_state(uint32_t pc, void *state)
+{
+  perceptron_state *st = (perceptron_state *)state;
+  lookup(pc, &st->l);
+  memcpy(st->hist, histBuf + histPos, (numTables - 1) * segLen + lanes);
+  return (st->l.y >= 0) ? TAKEN : NOTTAKEN;
+}
+
+void PerceptronPredictor::train_state(const void *state, uint32_t outcome)
+{
+  const perceptron_state *st = (const perceptron_state *)state;
+  train_lookup(&st->l, st->hist, outcome);
+}
+
+// Shift 'outcome' in as the newest history bit. The window slides down
+// histBuf and is copied back to the top when it reaches the bottom, with
+// room for restore_history() to move it back up.
+void PerceptronPredictor::shift_history(uint32_t pc, uint32_t outcome)
+{
+  if (histPos == 0)
+  {
+    int window = (numTables - 1) * segLen + lanes + HISTORY_REPAIR_MAX;
+    histPos = PERCEPTRON_HIST_BUF - window;
+    memmove(histBuf + histPos, histBuf, window);
+  }
+  histBuf[--histPos] = (outcome == TAKEN) ? 0 : -1;
+  shifts++;
+  ghist = (ghist << 1) | outcome;
+}
+
+size_t PerceptronPredictor::history_size()
+{
+  return sizeof(perceptron_history);
+}
+
+void PerceptronPredictor::save_history(uint32_t pc, void *buf)
+{
+  perceptron_history *h = (perceptron_history *)buf;
+  h->shifts = shifts;
+  h->ghist = ghist;
+}
+
+void PerceptronPredictor::restore_history(const void *buf)
+{
+  const perceptron_history *h = (const perceptron_history *)buf;
+  histPos += (int)(shifts - h->shifts);
+  shifts = h->shifts;
+  ghist = h->ghist;
+}
+
+void PerceptronPredictor::config_budget(int historyLength, predictor_budget *b)
+{
+  budget_add(b, "Weights", ((uint64_t)historyLength << row_bits(historyLength)) * 8, 0);
+  budget_add(b, "Bias weights", PERCEPTRON_BIAS_ENTRIES * 8, 0);
+  budget_add(b, "Global history", historyLength, 1);
+}
+
+void PerceptronPredictor::budget(predictor_budget *b)
+{
+  config_budget(historyLength, b);
+}
+
+void PerceptronPredictor::snapshot(snapshot_io *io)
+{
+  snapshot_bytes(io, weights, ((size_t)numTables << rowBits) * lanes);
+  snapshot_bytes(io, bias, sizeof(bias));
+  snapshot_bytes(io, histBuf, sizeof(histBuf));
+  snapshot_bytes(io, &histPos, sizeof(histPos));
+  snapshot_bytes(io, &shifts, sizeof(shifts));
+  snapshot_bytes(io, &ghist, sizeof(ghist));
+  last.valid = 0;
+}
+
+void PerceptronPredictor::train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
 {
-  switch (bpType)
+  if (!condition)
+    return;
+
+  // Reuse the lookup of the prediction for this branch
+  if (!last.valid || last.pc != pc)
+    lookup(pc, &last);
+  last.valid = 0;
+
+  train_lookup(&last, histBuf + histPos, outcome);
+  PerceptronPredictor::shift_history(pc, outcome);
+}
+
+// Train the rows of 'l' over the history 'hist' it was predicted with
+void PerceptronPredictor::train_lookup(const perceptron_lookup *l, const int8_t *hist, uint32_t outcome)
+{
+  uint32_t pred = (l->y >= 0) ? TAKEN : NOTTAKEN;
+  if (pred != outcome || abs(l->y) <= threshold)
+  {
+    int8_t &b = bias[l->biasIndex];
+    if (outcome == TAKEN && b < 127)
+      b++;
+    else if (outcome == NOTTAKEN && b > -127)
+      b--;
+    update(l->rows, hist, laneMask, numTables, segLen, lanes, (outcome == TAKEN) ? 0 : -1);
+  }
+}
+
+Predictor *create_predictor(const predictor_config *cfg)
+{
+  switch (cfg->bpType)
   {
   case STATIC:
-    break;
+    return new StaticPredictor();
   case GSHARE:
-    init_gshare();
-    break;
+    if (cfg->ghistoryBits >= GSHARE_KERNEL_MIN && cfg->ghistoryBits <= GSHARE_KERNEL_MAX)
+      return gshareKernels[cfg->ghistoryBits - GSHARE_KERNEL_MIN]();
+    return new GsharePredictor(cfg->ghistoryBits);
   case TOURNAMENT:
-    init_tournament();
-    break;
+    return new TournamentPredictor(cfg->ghistoryBits, cfg->lhistoryBits, cfg->pcIndexBits);
   case CUSTOM:
-    init_tage();
-    break;
+    return new TagePredictor();
+  case PERCEPTRON:
+    return new PerceptronPredictor(cfg->historyLength, cfg->numTables);
+  case TAGESCL:
+    return new TageSclPredictor(cfg->numComponents, cfg->minHistory, cfg->maxHistory);
   default:
-    break;
+    return NULL;
   }
 }
 
+void init_predictor()
+{
+  predictor_config cfg;
+  get_predictor_config(&cfg);
+
+  delete activePredictor;
+  activePredictor = create_predictor(&cfg);
+}
+
 // Make a prediction for conditional branch instruction at PC 'pc'
 // Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
 // indicates a prediction of not taken
 //
 uint32_t make_prediction(uint32_t pc, uint32_t target, uint32_t direct)
 {
+  // If there is not a compatable bpType then return NOTTAKEN
+  if (activePredictor == NULL)
+    return NOTTAKEN;
+
+  return activePredictor->predict(pc, target, direct);
+}
+
+// Train the predictor the last executed branch at PC 'pc' and with
+// outcome 'outcome' (true indicates that the branch was taken, false
+// indicates that the branch was not taken)
+//
+
+void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  if (activePredictor != NULL)
+    activePredictor->train(pc, target, outcome, condition, call, ret, direct);
+}
 
-  // Make a prediction based on the bpType
-  switch (bpType)
+uint64_t predict_batch(const branch_record *recs, size_t n, uint8_t *predictions)
+{
+  if (activePredictor == NULL)
+  {
+    // Every branch is predicted NOTTAKEN, as by make_prediction()
+    uint64_t mispredictions = 0;
+    for (size_t k = 0; k < n; k++)
+    {
+      if (recs[k].condition)
+      {
+        mispredictions += (recs[k].outcome != NOTTAKEN);
+        if (predictions != NULL)
+          predictions[k] = NOTTAKEN;
+      }
+    }
+    return mispredictions;
+  }
+  return activePredictor->run_batch(recs, n, prefetchDistance, predictions);
+}
+
+void train_batch(const branch_record *recs, size_t n)
+{
+  if (activePredictor != NULL)
+    activePredictor->train_batch(recs, n, prefetchDistance);
+}
+
+void snapshot_bytes(snapshot_io *io, void *p, size_t bytes)
+{
+  if (!io->ok)
+    return;
+  size_t n = io->loading ? fread(p, 1, bytes, io->f) : fwrite(p, 1, bytes, io->f);
+  io->ok = (n == bytes);
+}
+
+void snapshot_predictor(snapshot_io *io)
+{
+  if (activePredictor != NULL)
+    activePredictor->snapshot(io);
+}
+
+Predictor *get_active_predictor()
+{
+  return activePredictor;
+}
+
+void cleanup_predictor()
+{
+  delete activePredictor;
+  activePredictor = NULL;
+}
+
+// budget functions
+
+void budget_add(predictor_budget *b, const char *name, uint64_t bits, int isRegister)
+{
+  if (b->numItems < BUDGET_MAX_ITEMS)
+  {
+    budget_item *item = &b->items[b->numItems++];
+    item->name = name;
+    item->bits = bits;
+    item->isRegister = isRegister;
+  }
+  if (isRegister)
+    b->registerBits += bits;
+  else
+    b->tableBits += bits;
+}
+
+// Sized from the configuration alone, as create_predictor would build
+// it, so no tables are allocated
+void get_config_budget(const predictor_config *cfg, predictor_budget *b)
+{
+  memset(b, 0, sizeof(*b));
+  switch (cfg->bpType)
   {
-  case STATIC:
-    return TAKEN;
   case GSHARE:
-    return gshare_predict(pc);
+    GsharePredictor::config_budget(cfg->ghistoryBits, b);
+    break;
   case TOURNAMENT:
-    return tournament_predict(pc);
+    TournamentPredictor::config_budget(cfg->ghistoryBits, cfg->lhistoryBits, cfg->pcIndexBits, b);
+    break;
   case CUSTOM:
-    return tage_predict(pc);
+    TagePredictor::config_budget(b);
+    break;
+  case PERCEPTRON:
+    PerceptronPredictor::config_budget(cfg->historyLength, b);
+    break;
+  case TAGESCL:
+  {
+    int histLength[TSL_MAX_TABLES], tagBits[TSL_MAX_TABLES], logEntries[TSL_MAX_TABLES];
+    int numTables = TageSclPredictor::size_tables(cfg->numComponents, cfg->minHistory, cfg->maxHistory, histLength,
+                                                  tagBits, logEntries);
+    TageSclPredictor::config_budget(numTables, histLength, tagBits, logEntries, b);
+    break;
+  }
   default:
     break;
   }
+}
 
-  // If there is not a compatable bpType then return NOTTAKEN
-  return NOTTAKEN;
+void get_predictor_budget(predictor_budget *b)
+{
+  memset(b, 0, sizeof(*b));
+  if (activePredictor != NULL)
+    activePredictor->budget(b);
 }
 
-// Train the predictor the last executed branch at PC 'pc' and with
-// outcome 'outcome' (true indicates that the branch was taken, false
-// indicates that the branch was not taken)
-//
+int budget_fits(const predictor_budget *b)
+{
+  return b->tableBits <= BUDGET_TABLE_BITS && b->registerBits <= BUDGET_REGISTER_BITS;
+}
 
-void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+void print_budget(const predictor_budget *b)
 {
-  if (condition)
+  printf("%-24s %10s\n", "Structure", "Bits");
+  for (int i = 0; i < b->numItems; i++)
   {
-    switch (bpType)
-    {
-    case STATIC:
-      return;
-    case GSHARE:
-      return train_gshare(pc, outcome);
-    case TOURNAMENT:
-      return train_tournament(pc, outcome);;
-    case CUSTOM:
-      return train_tage(pc, outcome);
-    default:
-      break;
-    }
+    const budget_item *item = &b->items[i];
+    printf("%-24s %10llu%s\n", item->name, (unsigned long long)item->bits, item->isRegister ? " (register)" : "");
   }
+  printf("%-24s %10llu of %d\n", "Table Bits:", (unsigned long long)b->tableBits, BUDGET_TABLE_BITS);
+  printf("%-24s %10llu of %d\n", "Register Bits:", (unsigned long long)b->registerBits, BUDGET_REGISTER_BITS);
+}
+
+void get_predictor_config(predictor_config *cfg)
+{
+  cfg->bpType = bpType;
+  cfg->ghistoryBits = (bpType == TOURNAMENT) ? ghistoryBits_tournament : ghistoryBits;
+  cfg->lhistoryBits = lhistoryBits;
+  cfg->pcIndexBits = pcIndexBits;
+  cfg->historyLength = perceptronHistory;
+  cfg->numTables = perceptronTables;
+  cfg->numComponents = tageComponents;
+  cfg->minHistory = tageMinHistory;
+  cfg->maxHistory = tageMaxHistory;
+}
+
+void set_predictor_config(const predictor_config *cfg)
+{
+  bpType = cfg->bpType;
+  if (bpType == TOURNAMENT)
+    ghistoryBits_tournament = cfg->ghistoryBits;
+  else
+    ghistoryBits = cfg->ghistoryBits;
+  lhistoryBits = cfg->lhistoryBits;
+  pcIndexBits = cfg->pcIndexBits;
+  perceptronHistory = cfg->historyLength;
+  perceptronTables = cfg->numTables;
+  tageComponents = cfg->numComponents;
+  tageMinHistory = cfg->minHistory;
+  tageMaxHistory = cfg->maxHistory;
 }
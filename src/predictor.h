@@ -97,6 +97,233 @@ void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t co
 // Please add your code below, and DO NOT MODIFY ANY OF THE CODE ABOVE
 // 
 
+//------------------------------------//
+//     Predictor Configurations       //
+//------------------------------------//
+
+// Predictor types beyond the original four
+#define PERCEPTRON 4
+#define TAGESCL 5
+#define NUM_BP_TYPES 6
+
+// Hardware budget: table storage plus registers and such, in bits
+#define BUDGET_TABLE_BITS 65536
+#define BUDGET_REGISTER_BITS 1024
+
+extern int perceptronHistory; // Global history length of the perceptron
+extern int perceptronTables;  // Number of perceptron weight tables
+extern int tageComponents;    // Tagged components of TAGE-SC-L
+extern int tageMinHistory;    // Shortest and longest history of TAGE-SC-L
+extern int tageMaxHistory;
+extern int prefetchDistance;  // Records ahead batches prefetch, 0 for none
+
+// A predictor type together with its table sizes
+typedef struct
+{
+  int bpType;
+  int ghistoryBits; // Gshare history, or Tournament global history
+  int lhistoryBits; // Tournament local history
+  int pcIndexBits;  // Tournament local history table index
+  int historyLength; // Perceptron global history
+  int numTables;     // Perceptron weight tables
+  int numComponents; // TAGE-SC-L tagged components
+  int minHistory;    // TAGE-SC-L shortest and longest history
+  int maxHistory;
+} predictor_config;
+
+// The configuration the predictor variables currently hold
+//
+void get_predictor_config(predictor_config *cfg);
+
+// Set the predictor configuration variables, takes effect at the next
+// init_predictor()
+//
+void set_predictor_config(const predictor_config *cfg);
+
+// Free the tables allocated by init_predictor()
+//
+void cleanup_predictor();
+
+#include "trace.h"
+
+// Predict and train the predictor with 'n' records, as make_prediction()
+// and train_predictor() would one record at a time. The prediction of
+// each conditional branch recs[k] is left in predictions[k] unless
+// 'predictions' is NULL.
+//
+// Returns the number of mispredicted conditional branches
+//
+uint64_t predict_batch(const branch_record *recs, size_t n, uint8_t *predictions);
+
+// Train the predictor with 'n' records, as train_predictor() would one
+// record at a time, without predicting them
+//
+void train_batch(const branch_record *recs, size_t n);
+
+//------------------------------------//
+//          Hardware Budget           //
+//------------------------------------//
+
+#define BUDGET_MAX_ITEMS 24
+
+// What happens to a configuration over budget
+#define BUDGET_OFF 0      // Nothing
+#define BUDGET_WARN 1     // A warning on stderr
+#define BUDGET_ENFORCE 2  // It is refused, or left out of a sweep
+
+// One structure of a predictor and its storage
+typedef struct
+{
+  const char *name;
+  uint64_t bits;
+  int isRegister;  // Counted against BUDGET_REGISTER_BITS, not the tables
+} budget_item;
+
+// Every structure of a predictor, and the totals against each budget
+typedef struct
+{
+  int numItems;
+  budget_item items[BUDGET_MAX_ITEMS];
+  uint64_t tableBits;
+  uint64_t registerBits;
+} predictor_budget;
+
+// Add a structure of 'bits' bits to 'b'
+//
+void budget_add(predictor_budget *b, const char *name, uint64_t bits, int isRegister);
+
+// The storage of the predictor 'cfg' describes, computed without
+// building it
+//
+void get_config_budget(const predictor_config *cfg, predictor_budget *b);
+
+// The storage of the active predictor
+//
+void get_predictor_budget(predictor_budget *b);
+
+// Returns True if 'b' fits both the table and the register budget
+//
+int budget_fits(const predictor_budget *b);
+
+// Print 'b' one structure per line, then the totals
+//
+void print_budget(const predictor_budget *b);
 
+//------------------------------------//
+//        Predictor Snapshots         //
+//------------------------------------//
+
+#include <stdio.h>
+
+// A stream a predictor state is written to, or read back from
+typedef struct
+{
+  FILE *f;
+  int loading;  // Read into the predictor rather than write it out
+  int ok;       // Cleared by a short read or write
+} snapshot_io;
+
+// Write the 'bytes' bytes at 'p' to io->f, or read them into 'p' if
+// loading
+//
+void snapshot_bytes(snapshot_io *io, void *p, size_t bytes);
+
+// Write the tables and histories of the predictor to 'io', or read them
+// back into it (see Predictor::snapshot)
+//
+void snapshot_predictor(snapshot_io *io);
+
+//------------------------------------//
+//         Predictor Objects          //
+//------------------------------------//
+
+// A predictor instance owning its tables and history. The functions
+// above drive one instance built from the configuration variables; any
+// number of others can be created and run side by side.
+//
+class Predictor
+{
+public:
+  virtual ~Predictor() {}
+
+  // Same contract as make_prediction()
+  virtual uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct) = 0;
+
+  // Same contract as train_predictor(), including ignoring unconditional
+  // branches
+  virtual void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct) = 0;
+
+  // Same contract as predict_batch(). Predictors with large tables
+  // prefetch the entries of the record 'distance' records ahead: the
+  // trace gives the outcomes in between, so its history is known exactly.
+  //
+  virtual uint64_t run_batch(const branch_record *recs, size_t n, int distance, uint8_t *predictions);
+
+  // Same contract as train_batch(), prefetching like run_batch()
+  //
+  virtual void train_batch(const branch_record *recs, size_t n, int distance);
+
+  // Pipelined use, where a conditional branch trains well after it was
+  // predicted (see pipeline.h). The caller keeps what each prediction
+  // leaves for its update, so any number of branches can be in flight.
+
+  // Bytes a prediction leaves for its update
+  virtual size_t state_size() = 0;
+
+  // Predict the conditional branch at 'pc' like predict(), keeping what
+  // its update needs in 'state'. Histories are left alone.
+  //
+  virtual uint32_t predict_state(uint32_t pc, void *state) = 0;
+
+  // Train the entries 'state' looked up with the resolved 'outcome'
+  //
+  virtual void train_state(const void *state, uint32_t outcome) = 0;
+
+  // Shift 'outcome', resolved or only predicted, into the histories as
+  // the outcome of the conditional branch at 'pc'
+  //
+  virtual void shift_history(uint32_t pc, uint32_t outcome) = 0;
+
+  // Speculative histories: predicted outcomes are shifted in at fetch,
+  // each after a checkpoint, and a mispredicted branch restores the
+  // checkpoints back to its own before shifting its actual outcome.
+
+  // Bytes a history checkpoint takes
+  virtual size_t history_size() = 0;
+
+  // Save what the next shift_history() of the branch at 'pc' changes
+  //
+  virtual void save_history(uint32_t pc, void *buf) = 0;
+
+  // Undo the shift 'buf' was saved before. Checkpoints younger than 'buf'
+  // must be restored first, youngest first, and at most HISTORY_REPAIR_MAX
+  // shifts can be undone.
+  //
+  virtual void restore_history(const void *buf) = 0;
+
+  // Add every structure of the predictor to 'b'
+  //
+  virtual void budget(predictor_budget *b) = 0;
+
+  // Write every table and history to 'io', or read them back into a
+  // predictor created from the same configuration. Only the state left
+  // between two records is kept.
+  //
+  virtual void snapshot(snapshot_io *io) = 0;
+};
+
+// Shifts a checkpoint may undo
+#define HISTORY_REPAIR_MAX 256
+
+// Create a predictor for 'cfg'
+//
+// Returns NULL if cfg->bpType is unknown
+//
+Predictor *create_predictor(const predictor_config *cfg);
+
+// The predictor init_predictor() built, for callers that drive it
+// directly rather than through make_prediction()
+//
+Predictor *get_active_predictor();
 
 #endif
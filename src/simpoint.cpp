@@ -0,0 +1,108 @@
+//========================================================//
+//  simpoint.cpp                                          //
+//  Source file for representative trace intervals        //
+//                                                        //
+//  Reads and writes simpoint files                       //
+//========================================================//
+#include <stdio.h>
+#include <stdlib.h>
+#include "simpoint.h"
+
+static int compare_points(const void *a, const void *b)
+{
+  uint64_t x = ((const simpoint *)a)->interval;
+  uint64_t y = ((const simpoint *)b)->interval;
+  return (x > y) - (x < y);
+}
+
+int read_simpoints(const char *path, simpoint_set *s)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+  {
+    perror(path);
+    return 0;
+  }
+
+  int version;
+  unsigned long long records, intervals;
+  if (fscanf(f, "simpoints %d %llu %llu", &version, &records, &intervals) != 3 ||
+      version != SIMPOINT_VERSION || records == 0)
+  {
+    fprintf(stderr, "%s: Not a simpoint file of version %d\n", path, SIMPOINT_VERSION);
+    fclose(f);
+    return 0;
+  }
+  s->intervalRecords = records;
+  s->numIntervals = intervals;
+  s->numPoints = 0;
+  s->points = NULL;
+
+  int capacity = 0;
+  unsigned long long interval;
+  double weight;
+  while (fscanf(f, "%llu %lf", &interval, &weight) == 2)
+  {
+    if (s->numPoints == capacity)
+    {
+      capacity = capacity ? 2 * capacity : 16;
+      s->points = (simpoint *)realloc(s->points, capacity * sizeof(simpoint));
+    }
+    s->points[s->numPoints].interval = interval;
+    s->points[s->numPoints].weight = weight;
+    s->numPoints++;
+  }
+  int ok = feof(f) && s->numPoints > 0;
+  fclose(f);
+  if (!ok)
+  {
+    fprintf(stderr, "%s: Malformed simpoint\n", path);
+    free_simpoints(s);
+    return 0;
+  }
+
+  sort_simpoints(s);
+  for (int i = 1; i < s->numPoints; i++)
+  {
+    if (s->points[i].interval == s->points[i - 1].interval)
+    {
+      fprintf(stderr, "%s: Interval %llu given twice\n", path, (unsigned long long)s->points[i].interval);
+      free_simpoints(s);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int write_simpoints(const char *path, const simpoint_set *s)
+{
+  FILE *f = fopen(path, "w");
+  if (f == NULL)
+  {
+    perror(path);
+    return 0;
+  }
+
+  fprintf(f, "simpoints %d %llu %llu\n", SIMPOINT_VERSION, (unsigned long long)s->intervalRecords,
+          (unsigned long long)s->numIntervals);
+  for (int i = 0; i < s->numPoints; i++)
+    fprintf(f, "%llu %.6f\n", (unsigned long long)s->points[i].interval, s->points[i].weight);
+  if (fclose(f) != 0)
+  {
+    fprintf(stderr, "%s: Could not write the simpoints\n", path);
+    return 0;
+  }
+  return 1;
+}
+
+void sort_simpoints(simpoint_set *s)
+{
+  qsort(s->points, s->numPoints, sizeof(simpoint), compare_points);
+}
+
+void free_simpoints(simpoint_set *s)
+{
+  free(s->points);
+  s->points = NULL;
+  s->numPoints = 0;
+}
@@ -0,0 +1,57 @@
+//========================================================//
+//  simpoint.h                                            //
+//  Header file for representative trace intervals        //
+//                                                        //
+//  pick_simpoints splits a trace into fixed-size         //
+//  intervals and picks one per cluster of similar        //
+//  intervals; predictor simulates only those             //
+//========================================================//
+
+#ifndef SIMPOINT_H
+#define SIMPOINT_H
+
+#include <stdint.h>
+
+// Simpoint file, text:
+//   simpoints <version> <records per interval> <intervals in the trace>
+// then one line per representative interval:
+//   <interval> <weight>
+// Intervals count from 0, and the weights, the share of the trace each
+// one stands for, add up to 1.
+#define SIMPOINT_VERSION 1
+
+typedef struct
+{
+  uint64_t interval;
+  double weight;
+} simpoint;
+
+typedef struct
+{
+  uint64_t intervalRecords;
+  uint64_t numIntervals;
+  int numPoints;
+  simpoint *points;   // In trace order
+} simpoint_set;
+
+// Read the simpoints in 'path' into 's'
+//
+// Returns True if Successful
+//
+int read_simpoints(const char *path, simpoint_set *s);
+
+// Write 's' to 'path'
+//
+// Returns True if Successful
+//
+int write_simpoints(const char *path, const simpoint_set *s);
+
+// Put the points of 's' in trace order
+//
+void sort_simpoints(simpoint_set *s);
+
+// Free the points of 's'
+//
+void free_simpoints(simpoint_set *s);
+
+#endif
@@ -0,0 +1,142 @@
+//========================================================//
+//  snapshot.cpp                                          //
+//  Source file for predictor snapshots                   //
+//                                                        //
+//  The header is written field by field, the predictor   //
+//  state by the predictor itself                         //
+//========================================================//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+
+static void put_le32(uint8_t *dst, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    dst[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_le64(uint8_t *dst, uint64_t v)
+{
+  put_le32(dst, (uint32_t)v);
+  put_le32(dst + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_le32(const uint8_t *src)
+{
+  return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *src)
+{
+  return (uint64_t)get_le32(src) | ((uint64_t)get_le32(src + 4) << 32);
+}
+
+// The configuration fields in header order
+static void config_fields(predictor_config *cfg, int **fields)
+{
+  int *all[SNAPSHOT_CONFIG_FIELDS] = {
+      &cfg->bpType, &cfg->ghistoryBits, &cfg->lhistoryBits, &cfg->pcIndexBits,
+      &cfg->historyLength, &cfg->numTables, &cfg->numComponents, &cfg->minHistory, &cfg->maxHistory};
+  memcpy(fields, all, sizeof(all));
+}
+
+int parse_snapshot_option(const char *spec, uint64_t *records, const char **path)
+{
+  char *end;
+  *records = strtoull(spec, &end, 10);
+  if (end == spec || *end != ':' || end[1] == '\0')
+    return 0;
+  *path = end + 1;
+  return 1;
+}
+
+int save_snapshot(const char *path, const snapshot_header *h)
+{
+  FILE *f = fopen(path, "wb");
+  if (f == NULL)
+  {
+    perror(path);
+    return 0;
+  }
+
+  uint8_t header[SNAPSHOT_HEADER_BYTES];
+  memcpy(header, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_BYTES);
+  header[4] = SNAPSHOT_VERSION & 0xFF;
+  header[5] = SNAPSHOT_VERSION >> 8;
+  header[6] = SNAPSHOT_CONFIG_FIELDS;
+  header[7] = 0;
+
+  predictor_config cfg = h->cfg;
+  int *fields[SNAPSHOT_CONFIG_FIELDS];
+  config_fields(&cfg, fields);
+  for (int i = 0; i < SNAPSHOT_CONFIG_FIELDS; i++)
+    put_le32(header + 8 + 4 * i, (uint32_t)*fields[i]);
+  put_le64(header + 44, h->records);
+  put_le64(header + 52, h->traceRecords);
+  put_le64(header + 60, h->branches);
+  put_le64(header + 68, h->mispredictions);
+
+  snapshot_io io = {f, 0, 1};
+  snapshot_bytes(&io, header, sizeof(header));
+  snapshot_predictor(&io);
+  if (fclose(f) != 0)
+    io.ok = 0;
+  if (!io.ok)
+    fprintf(stderr, "%s: Could not write the snapshot\n", path);
+  return io.ok;
+}
+
+int load_snapshot(const char *path, snapshot_header *h)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL)
+  {
+    perror(path);
+    return 0;
+  }
+
+  uint8_t header[SNAPSHOT_HEADER_BYTES];
+  snapshot_io io = {f, 1, 1};
+  snapshot_bytes(&io, header, sizeof(header));
+  if (!io.ok || memcmp(header, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_BYTES))
+  {
+    fprintf(stderr, "%s: Not a predictor snapshot\n", path);
+    fclose(f);
+    return 0;
+  }
+  if (header[4] != (SNAPSHOT_VERSION & 0xFF) || header[5] != (SNAPSHOT_VERSION >> 8) ||
+      header[6] != SNAPSHOT_CONFIG_FIELDS || header[7] != 0)
+  {
+    fprintf(stderr, "%s: Unsupported snapshot version %d\n", path, header[4] | (header[5] << 8));
+    fclose(f);
+    return 0;
+  }
+
+  int *fields[SNAPSHOT_CONFIG_FIELDS];
+  config_fields(&h->cfg, fields);
+  for (int i = 0; i < SNAPSHOT_CONFIG_FIELDS; i++)
+    *fields[i] = (int)get_le32(header + 8 + 4 * i);
+  h->records = get_le64(header + 44);
+  h->traceRecords = get_le64(header + 52);
+  h->branches = get_le64(header + 60);
+  h->mispredictions = get_le64(header + 68);
+  if (h->cfg.bpType < 0 || h->cfg.bpType >= NUM_BP_TYPES)
+  {
+    fprintf(stderr, "%s: Unknown predictor type %d\n", path, h->cfg.bpType);
+    fclose(f);
+    return 0;
+  }
+
+  // The predictor is built to the saved configuration, so the state that
+  // follows fills its tables exactly
+  set_predictor_config(&h->cfg);
+  init_predictor();
+  snapshot_predictor(&io);
+  if (io.ok && fgetc(f) != EOF)
+    io.ok = 0;
+  fclose(f);
+  if (!io.ok)
+    fprintf(stderr, "%s: Snapshot truncated or of another build\n", path);
+  return io.ok;
+}
@@ -0,0 +1,62 @@
+//========================================================//
+//  snapshot.h                                            //
+//  Header file for predictor snapshots                   //
+//                                                        //
+//  A snapshot holds the configuration, tables and        //
+//  histories of the predictor partway through a trace,   //
+//  so a run can resume from it                           //
+//========================================================//
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "predictor.h"
+
+// Snapshot header (all fields little-endian):
+//   bytes 0-3   magic "\x89BPS"
+//   bytes 4-5   format version
+//   bytes 6-7   number of configuration fields that follow
+//   bytes 8-43  predictor_config, one 32-bit field each
+//   bytes 44-51 trace records simulated before the snapshot
+//   bytes 52-59 records in the whole trace, 0 if unknown
+//   bytes 60-67 conditional branches scored so far
+//   bytes 68-75 mispredictions so far
+// The tables and histories of the predictor follow in the byte order of
+// the host that saved them.
+#define SNAPSHOT_MAGIC "\x89" "BPS"
+#define SNAPSHOT_MAGIC_BYTES 4
+#define SNAPSHOT_HEADER_BYTES 76
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_CONFIG_FIELDS 9
+
+// Where in the trace a snapshot was taken
+typedef struct
+{
+  predictor_config cfg;
+  uint64_t records;         // Trace records simulated
+  uint64_t traceRecords;    // Records in the whole trace, 0 if unknown
+  uint64_t branches;        // Conditional branches scored
+  uint64_t mispredictions;
+} snapshot_header;
+
+// Parse "<records>:<path>" into 'records' and 'path'
+//
+// Returns True if Successful
+//
+int parse_snapshot_option(const char *spec, uint64_t *records, const char **path);
+
+// Write 'h' and the state of the predictor to 'path'
+//
+// Returns True if Successful
+//
+int save_snapshot(const char *path, const snapshot_header *h);
+
+// Read the header of 'path' into 'h', set the predictor configuration
+// from it and initialize the predictor with the saved state
+//
+// Returns True if Successful
+//
+int load_snapshot(const char *path, snapshot_header *h);
+
+#endif
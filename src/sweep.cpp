@@ -0,0 +1,393 @@
+//========================================================//
+//  sweep.cpp                                             //
+//  Source file for multi-configuration sweeps            //
+//                                                        //
+//  A reader decodes the trace into a ring of chunks that //
+//  every worker thread consumes; each worker runs its    //
+//  share of the configurations, one predictor object     //
+//  per configuration                                     //
+//========================================================//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include "sweep.h"
+
+// Records per ring chunk and number of chunks in flight
+#define SWEEP_CHUNK (16 * TRACE_BATCH)
+#define SWEEP_SLOTS 8
+
+// Accepted range of each configuration field, per predictor type
+typedef struct
+{
+  const char *name;
+  int fields;          // Number of size fields the type takes
+  int lo[3];
+  int hi[3];
+  size_t offset[3];    // Where each field is kept in predictor_config
+} config_rule;
+
+#define FIELD(name) offsetof(predictor_config, name)
+
+static const config_rule rules[NUM_BP_TYPES] = {
+    {"static", 0, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}},
+    {"gshare", 1, {1, 0, 0}, {30, 0, 0}, {FIELD(ghistoryBits), 0, 0}},
+    {"tournament", 3, {1, 1, 1}, {16, 16, 24},
+     {FIELD(ghistoryBits), FIELD(lhistoryBits), FIELD(pcIndexBits)}},
+    {"custom", 0, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}},
+    {"perceptron", 2, {1, 1, 0}, {128, 8, 0}, {FIELD(historyLength), FIELD(numTables), 0}},
+    {"tagescl", 3, {1, 1, 2}, {16, 64, 1024},
+     {FIELD(numComponents), FIELD(minHistory), FIELD(maxHistory)}},
+};
+
+// Field 'f' of 'cfg' under 'rule'
+static int *config_field(predictor_config *cfg, const config_rule *rule, int f)
+{
+  return (int *)((char *)cfg + rule->offset[f]);
+}
+
+// Configurations of the sweep
+static predictor_config *sweepConfigs = NULL;
+static int numSweepConfigs = 0;
+static int sweepCapacity = 0;
+
+// Parse "<n>" or "<lo>-<hi>" from 'p'
+//
+// Returns a pointer past the field, NULL if malformed
+//
+static const char *parse_range(const char *p, int *lo, int *hi)
+{
+  char *end;
+  *lo = strtol(p, &end, 10);
+  if (end == p)
+    return NULL;
+  *hi = *lo;
+  if (*end == '-')
+  {
+    p = end + 1;
+    *hi = strtol(p, &end, 10);
+    if (end == p || *hi < *lo)
+      return NULL;
+  }
+  return end;
+}
+
+int parse_config(const char *spec, predictor_config *cfgs, int max)
+{
+  predictor_config base;
+  get_predictor_config(&base);
+
+  int type = -1;
+  size_t name_len = strcspn(spec, ":");
+  for (int i = 0; i < NUM_BP_TYPES; i++)
+  {
+    if (strlen(rules[i].name) == name_len && !strncmp(spec, rules[i].name, name_len))
+      type = i;
+  }
+  if (type < 0)
+    return -1;
+  const config_rule *rule = &rules[type];
+
+  // Defaults are the sizes compiled into predictor.cpp
+  base.bpType = type;
+  base.ghistoryBits = (type == TOURNAMENT) ? ghistoryBits_tournament : ghistoryBits;
+  int lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0};
+  for (int f = 0; f < rule->fields; f++)
+    lo[f] = hi[f] = *config_field(&base, rule, f);
+
+  const char *p = spec + name_len;
+  for (int f = 0; *p == ':'; f++)
+  {
+    if (f == rule->fields)
+      return -1;
+    p = parse_range(p + 1, &lo[f], &hi[f]);
+    if (p == NULL || lo[f] < rule->lo[f] || hi[f] > rule->hi[f])
+      return -1;
+  }
+  if (*p != '\0')
+    return -1;
+
+  int n = 0;
+  int v[3];
+  for (v[0] = lo[0]; v[0] <= hi[0]; v[0]++)
+  {
+    for (v[1] = lo[1]; v[1] <= hi[1]; v[1]++)
+    {
+      for (v[2] = lo[2]; v[2] <= hi[2]; v[2]++)
+      {
+        if (n == max)
+          return -1;
+        cfgs[n] = base;
+        for (int f = 0; f < rule->fields; f++)
+          *config_field(&cfgs[n], rule, f) = v[f];
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+void format_config(const predictor_config *cfg, char *buf, size_t len)
+{
+  const config_rule *rule = &rules[cfg->bpType];
+  int used = snprintf(buf, len, "%s", rule->name);
+  for (int f = 0; f < rule->fields && used < (int)len; f++)
+    used += snprintf(buf + used, len - used, ":%d", *config_field((predictor_config *)cfg, rule, f));
+}
+
+// Add the configurations of one spec to the sweep
+//
+// Returns True if Successful
+//
+static int sweep_add_spec(const char *spec)
+{
+  predictor_config cfgs[1024];
+  int n = parse_config(spec, cfgs, 1024);
+  if (n < 0)
+  {
+    fprintf(stderr, "Invalid predictor configuration '%s'\n", spec);
+    return 0;
+  }
+
+  if (numSweepConfigs + n > sweepCapacity)
+  {
+    sweepCapacity = 2 * (numSweepConfigs + n);
+    sweepConfigs = (predictor_config *)realloc(sweepConfigs, sweepCapacity * sizeof(predictor_config));
+  }
+  memcpy(sweepConfigs + numSweepConfigs, cfgs, n * sizeof(predictor_config));
+  numSweepConfigs += n;
+  return 1;
+}
+
+// Add every whitespace or comma separated spec in 'buf'
+//
+static int sweep_add_words(char *buf)
+{
+  for (char *spec = strtok(buf, ", \t\r\n"); spec != NULL; spec = strtok(NULL, ", \t\r\n"))
+  {
+    if (!sweep_add_spec(spec))
+      return 0;
+  }
+  return 1;
+}
+
+int sweep_add(const char *list)
+{
+  if (list[0] != '@')
+  {
+    char *buf = strdup(list);
+    int ok = sweep_add_words(buf);
+    free(buf);
+    return ok;
+  }
+
+  FILE *f = fopen(list + 1, "r");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Error: cannot open %s\n", list + 1);
+    return 0;
+  }
+  char *line = NULL;
+  size_t len = 0;
+  int ok = 1;
+  while (ok && getline(&line, &len, f) != -1)
+  {
+    line[strcspn(line, "#")] = '\0';
+    ok = sweep_add_words(line);
+  }
+  free(line);
+  fclose(f);
+  return ok;
+}
+
+int sweep_size()
+{
+  return numSweepConfigs;
+}
+
+int sweep_check_budget(int policy)
+{
+  if (policy == BUDGET_OFF)
+    return numSweepConfigs;
+
+  int kept = 0;
+  for (int i = 0; i < numSweepConfigs; i++)
+  {
+    predictor_budget b;
+    get_config_budget(&sweepConfigs[i], &b);
+    if (!budget_fits(&b))
+    {
+      char name[64];
+      format_config(&sweepConfigs[i], name, sizeof(name));
+      fprintf(stderr, "%s %s: %llu table bits, %llu register bits\n",
+              (policy == BUDGET_ENFORCE) ? "Over budget, skipped" : "Warning: over budget",
+              name, (unsigned long long)b.tableBits, (unsigned long long)b.registerBits);
+      if (policy == BUDGET_ENFORCE)
+        continue;
+    }
+    sweepConfigs[kept++] = sweepConfigs[i];
+  }
+  numSweepConfigs = kept;
+  return kept;
+}
+
+// A chunk of decoded records, shared read-only by all workers
+typedef struct
+{
+  branch_record *recs;
+  size_t count;
+  int pending;       // Workers yet to consume the chunk
+} sweep_slot;
+
+typedef struct
+{
+  sweep_slot slots[SWEEP_SLOTS];
+  uint64_t produced; // Chunks published so far
+  int eof;
+  int num_workers;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} sweep_ring;
+
+// Results of every configuration, indexed like sweepConfigs
+typedef struct
+{
+  uint64_t num_branches;
+  uint64_t mispredictions;
+} sweep_result;
+
+// A worker runs configurations first, first + stride, ...
+typedef struct
+{
+  sweep_ring *ring;
+  sweep_result *results;
+  int first;
+  int stride;
+} sweep_worker;
+
+// Run the records of a chunk through predictor 'p'
+//
+static void simulate(Predictor *p, const branch_record *recs, size_t n, sweep_result *res)
+{
+  for (size_t k = 0; k < n; k++)
+    res->num_branches += (recs[k].condition == 1);
+  res->mispredictions += p->run_batch(recs, n, prefetchDistance, NULL);
+}
+
+static void *sweep_worker_main(void *arg)
+{
+  sweep_worker *w = (sweep_worker *)arg;
+  sweep_ring *ring = w->ring;
+
+  // Predictor tables are allocated and touched only by their worker
+  int n = 0;
+  Predictor **preds = (Predictor **)malloc(numSweepConfigs * sizeof(Predictor *));
+  for (int i = w->first; i < numSweepConfigs; i += w->stride)
+    preds[n++] = create_predictor(&sweepConfigs[i]);
+
+  for (uint64_t seq = 0;; seq++)
+  {
+    pthread_mutex_lock(&ring->lock);
+    while (ring->produced <= seq && !ring->eof)
+      pthread_cond_wait(&ring->cond, &ring->lock);
+    int done = (ring->produced <= seq);
+    pthread_mutex_unlock(&ring->lock);
+    if (done)
+      break;
+
+    sweep_slot *slot = &ring->slots[seq % SWEEP_SLOTS];
+    for (int j = 0; j < n; j++)
+      simulate(preds[j], slot->recs, slot->count, &w->results[w->first + j * w->stride]);
+
+    pthread_mutex_lock(&ring->lock);
+    if (--slot->pending == 0)
+      pthread_cond_broadcast(&ring->cond);
+    pthread_mutex_unlock(&ring->lock);
+  }
+
+  for (int j = 0; j < n; j++)
+    delete preds[j];
+  free(preds);
+  return NULL;
+}
+
+void sweep_run(trace_reader *t, int threads)
+{
+  int n = numSweepConfigs;
+  int num_workers = (threads < n) ? threads : n;
+  if (num_workers < 1)
+    num_workers = 1;
+
+  sweep_ring ring;
+  memset(&ring, 0, sizeof(ring));
+  ring.num_workers = num_workers;
+  pthread_mutex_init(&ring.lock, NULL);
+  pthread_cond_init(&ring.cond, NULL);
+  for (int s = 0; s < SWEEP_SLOTS; s++)
+    ring.slots[s].recs = (branch_record *)malloc(SWEEP_CHUNK * sizeof(branch_record));
+
+  sweep_result *results = (sweep_result *)calloc(n, sizeof(sweep_result));
+  sweep_worker *workers = (sweep_worker *)malloc(num_workers * sizeof(sweep_worker));
+  pthread_t *tids = (pthread_t *)malloc(num_workers * sizeof(pthread_t));
+  for (int i = 0; i < num_workers; i++)
+  {
+    workers[i].ring = &ring;
+    workers[i].results = results;
+    workers[i].first = i;
+    workers[i].stride = num_workers;
+    pthread_create(&tids[i], NULL, sweep_worker_main, &workers[i]);
+  }
+
+  // This thread is the reader: decode the trace once into the ring
+  for (uint64_t seq = 0;; seq++)
+  {
+    sweep_slot *slot = &ring.slots[seq % SWEEP_SLOTS];
+    pthread_mutex_lock(&ring.lock);
+    while (slot->pending > 0)
+      pthread_cond_wait(&ring.cond, &ring.lock);
+    pthread_mutex_unlock(&ring.lock);
+
+    size_t count = 0;
+    while (count + TRACE_BATCH <= SWEEP_CHUNK && trace_fill(t) > 0)
+    {
+      memcpy(slot->recs + count, t->recs, t->count * sizeof(branch_record));
+      count += t->count;
+    }
+
+    pthread_mutex_lock(&ring.lock);
+    if (count == 0)
+      ring.eof = 1;
+    else
+    {
+      slot->count = count;
+      slot->pending = num_workers;
+      ring.produced++;
+    }
+    pthread_cond_broadcast(&ring.cond);
+    pthread_mutex_unlock(&ring.lock);
+    if (count == 0)
+      break;
+  }
+
+  for (int i = 0; i < num_workers; i++)
+    pthread_join(tids[i], NULL);
+
+  printf("%-24s %10s %10s %19s\n", "Config", "Branches", "Incorrect", "Misprediction Rate");
+  for (int i = 0; i < n; i++)
+  {
+    char name[64];
+    format_config(&sweepConfigs[i], name, sizeof(name));
+    float mispredict_rate = 1000 * ((float)results[i].mispredictions / (float)results[i].num_branches);
+    printf("%-24s %10llu %10llu %19.3f\n", name, (unsigned long long)results[i].num_branches,
+           (unsigned long long)results[i].mispredictions, mispredict_rate);
+  }
+
+  for (int s = 0; s < SWEEP_SLOTS; s++)
+    free(ring.slots[s].recs);
+  pthread_mutex_destroy(&ring.lock);
+  pthread_cond_destroy(&ring.cond);
+  free(results);
+  free(workers);
+  free(tids);
+}
@@ -0,0 +1,52 @@
+//========================================================//
+//  sweep.h                                               //
+//  Header file for multi-configuration sweeps            //
+//                                                        //
+//  A sweep decodes the trace once and feeds every        //
+//  record to a list of predictor configurations          //
+//========================================================//
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "predictor.h"
+#include "trace.h"
+
+// Parse one configuration "<type>[:<size>...]", such as
+// "tournament:<ghist>:<lhist>:<pcindex>" or "perceptron:<hist>:<tables>",
+// where each number may be a range "<lo>-<hi>", into at most 'max'
+// configurations
+//
+// Returns the number of configurations, or -1 if 'spec' is invalid
+//
+int parse_config(const char *spec, predictor_config *cfgs, int max);
+
+// Format 'cfg' the way parse_config accepts it
+//
+void format_config(const predictor_config *cfg, char *buf, size_t len);
+
+// Add the comma-separated configurations in 'list' to the sweep; a list
+// of the form "@<file>" is read from a file, one or more per line
+//
+// Returns True if Successful
+//
+int sweep_add(const char *list);
+
+// Number of configurations added to the sweep
+//
+int sweep_size();
+
+// Check every configuration of the sweep against the hardware budget,
+// warning about or removing those over it as 'policy' (BUDGET_*) says
+//
+// Returns the number of configurations left
+//
+int sweep_check_budget(int policy);
+
+// Simulate every configuration of the sweep on one pass over 't', with
+// the configurations spread over 'threads' worker threads, and print one
+// result row per configuration
+//
+void sweep_run(trace_reader *t, int threads);
+
+#endif
@@ -0,0 +1,682 @@
+//========================================================//
+//  target.cpp                                            //
+//  Source file for branch target prediction              //
+//                                                        //
+//  A direct-mapped BTB as the baseline, and ITTAGE: a    //
+//  last-target base table backed by tagged tables over   //
+//  geometric lengths of global path history              //
+//========================================================//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "target.h"
+#include "history.h"
+
+//------------------------------------//
+//        Target Configuration        //
+//------------------------------------//
+
+#define BTB_TAG_BITS 16
+
+#define ITTAGE_MAX_TABLES 16
+#define ITTAGE_LOG_BASE 10      // log2 of the base table entries
+#define ITTAGE_LOG_ENTRIES 8    // log2 of the entries of each tagged table
+#define ITTAGE_MIN_TAG_BITS 9
+#define ITTAGE_MAX_TAG_BITS 13
+#define ITTAGE_CONF_MAX 3       // 2-bit confidence
+#define ITTAGE_PHIST_BITS 16
+#define ITTAGE_MAX_HISTORY 1024 // Longest history, well inside histBuf
+#define ITTAGE_HIST_BUF 4096    // Sliding history window, see push_history
+#define ITTAGE_U_PERIOD 65536   // Scored branches between usefulness resets
+
+int parse_target_config(const char *spec, target_config *cfg)
+{
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->logEntries = 10;
+  cfg->numTables = 6;
+  cfg->minHistory = 4;
+  cfg->maxHistory = 64;
+
+  int *fields[3];
+  int numFields;
+  size_t name_len = strcspn(spec, ":");
+  if (name_len == 3 && !strncmp(spec, "btb", 3))
+  {
+    cfg->type = TARGET_BTB;
+    fields[0] = &cfg->logEntries;
+    numFields = 1;
+  }
+  else if (name_len == 6 && !strncmp(spec, "ittage", 6))
+  {
+    cfg->type = TARGET_ITTAGE;
+    fields[0] = &cfg->numTables;
+    fields[1] = &cfg->minHistory;
+    fields[2] = &cfg->maxHistory;
+    numFields = 3;
+  }
+  else
+    return 0;
+
+  const char *p = spec + name_len;
+  for (int f = 0; *p == ':'; f++)
+  {
+    char *end;
+    if (f == numFields)
+      return 0;
+    *fields[f] = strtol(p + 1, &end, 10);
+    if (end == p + 1)
+      return 0;
+    p = end;
+  }
+  if (*p != '\0')
+    return 0;
+
+  if (cfg->type == TARGET_BTB)
+    return cfg->logEntries >= 1 && cfg->logEntries <= 24;
+  // The constructor stretches maxHistory to minHistory + numTables, so
+  // that sum is bounded too
+  return cfg->numTables >= 1 && cfg->numTables <= ITTAGE_MAX_TABLES &&
+         cfg->minHistory >= 1 && cfg->minHistory <= cfg->maxHistory &&
+         cfg->maxHistory <= ITTAGE_MAX_HISTORY && cfg->minHistory + cfg->numTables <= ITTAGE_MAX_HISTORY;
+}
+
+//------------------------------------//
+//     Target Predictor Structures    //
+//------------------------------------//
+
+//
+// btb
+class BtbTargetPredictor : public TargetPredictor
+{
+public:
+  BtbTargetPredictor(int logEntries);
+  ~BtbTargetPredictor();
+  uint32_t predict(uint32_t pc);
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+
+private:
+  int logEntries;
+  uint16_t *tags;     // 0 for an empty entry
+  uint32_t *targets;
+};
+
+//
+// ittage
+struct ittage_entry {
+    uint16_t tag;       // 0 for an empty entry
+    uint8_t conf;
+    uint8_t u;          // 1-bit usefulness
+    uint32_t target;
+};
+
+// Everything the prediction for one branch looked up, so the update
+// for that branch need not repeat it
+struct ittage_lookup {
+    uint32_t pc;
+    uint8_t valid;                     // Not yet consumed by train()
+    uint32_t baseIndex;
+    uint32_t index[ITTAGE_MAX_TABLES];
+    uint16_t tag[ITTAGE_MAX_TABLES];
+    int provider;                      // Longest matching table, or -1
+    uint32_t altTarget;                // Next longest match, or the base
+    uint32_t pred;
+};
+
+class IttagePredictor : public TargetPredictor
+{
+public:
+  IttagePredictor(int numTables, int minHistory, int maxHistory);
+  ~IttagePredictor();
+  uint32_t predict(uint32_t pc);
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+
+private:
+  void lookup(uint32_t pc);
+  void push_history(uint32_t pc, uint8_t bit);
+
+  int numTables;
+  int histLength[ITTAGE_MAX_TABLES];
+  int tagBits[ITTAGE_MAX_TABLES];
+  uint32_t *base;                              // Last target per PC
+  ittage_entry *tables[ITTAGE_MAX_TABLES];
+  uint32_t scored;
+
+  uint8_t histBuf[ITTAGE_HIST_BUF];            // Newest bit at histBuf[histPos]
+  int histPos;
+  uint32_t phist;                              // Path history
+  folded_history indexFold[ITTAGE_MAX_TABLES];
+  folded_history tagFold0[ITTAGE_MAX_TABLES];
+  folded_history tagFold1[ITTAGE_MAX_TABLES];
+
+  ittage_lookup last;
+};
+
+//------------------------------------//
+//     Target Predictor Functions     //
+//------------------------------------//
+
+// btb functions
+BtbTargetPredictor::BtbTargetPredictor(int logEntries)
+{
+  this->logEntries = logEntries;
+  tags = (uint16_t *)calloc(1 << logEntries, sizeof(uint16_t));
+  targets = (uint32_t *)calloc(1 << logEntries, sizeof(uint32_t));
+}
+
+BtbTargetPredictor::~BtbTargetPredictor()
+{
+  free(tags);
+  free(targets);
+}
+
+// Tags are the PC bits above the index, with the top bit marking the
+// entry valid
+static inline uint16_t btb_tag(uint32_t pc, int logEntries)
+{
+  return ((pc >> logEntries) & ((1 << (BTB_TAG_BITS - 1)) - 1)) | (1 << (BTB_TAG_BITS - 1));
+}
+
+uint32_t BtbTargetPredictor::predict(uint32_t pc)
+{
+  uint32_t i = pc & ((1 << logEntries) - 1);
+  return (tags[i] == btb_tag(pc, logEntries)) ? targets[i] : 0;
+}
+
+void BtbTargetPredictor::train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  if (!target_scored(ret, direct))
+    return;
+
+  uint32_t i = pc & ((1 << logEntries) - 1);
+  tags[i] = btb_tag(pc, logEntries);
+  targets[i] = target;
+}
+
+// ittage functions
+IttagePredictor::IttagePredictor(int numTables, int minHistory, int maxHistory)
+{
+  this->numTables = numTables;
+  if (maxHistory < minHistory + numTables)
+    maxHistory = minHistory + numTables;
+  for (int t = 0; t < numTables; t++)
+  {
+    double r = (numTables > 1) ? (double)t / (numTables - 1) : 0;
+    histLength[t] = (int)(minHistory * pow((double)maxHistory / minHistory, r) + 0.5);
+    if (t > 0 && histLength[t] <= histLength[t - 1])
+      histLength[t] = histLength[t - 1] + 1;
+    if (histLength[t] > ITTAGE_MAX_HISTORY)
+      histLength[t] = ITTAGE_MAX_HISTORY;
+    tagBits[t] = ITTAGE_MIN_TAG_BITS;
+    if (numTables > 1)
+      tagBits[t] += t * (ITTAGE_MAX_TAG_BITS - ITTAGE_MIN_TAG_BITS) / (numTables - 1);
+
+    tables[t] = (ittage_entry *)calloc(1 << ITTAGE_LOG_ENTRIES, sizeof(ittage_entry));
+    indexFold[t].init(histLength[t], ITTAGE_LOG_ENTRIES);
+    tagFold0[t].init(histLength[t], tagBits[t]);
+    tagFold1[t].init(histLength[t], tagBits[t] - 1);
+  }
+  base = (uint32_t *)calloc(1 << ITTAGE_LOG_BASE, sizeof(uint32_t));
+  scored = 0;
+
+  memset(histBuf, 0, sizeof(histBuf));
+  histPos = ITTAGE_HIST_BUF - (histLength[numTables - 1] + 1);
+  phist = 0;
+  last.valid = 0;
+}
+
+IttagePredictor::~IttagePredictor()
+{
+  for (int t = 0; t < numTables; t++)
+    free(tables[t]);
+  free(base);
+}
+
+// Look up every table for 'pc' once, leaving the result in 'last'. A
+// provider that has not yet confirmed its target defers to the next
+// match.
+void IttagePredictor::lookup(uint32_t pc)
+{
+  ittage_lookup *l = &last;
+  l->pc = pc;
+  l->valid = 1;
+  l->baseIndex = pc & ((1 << ITTAGE_LOG_BASE) - 1);
+
+  l->provider = -1;
+  int alt = -1;
+  for (int t = numTables - 1; t >= 0; t--)
+  {
+    uint32_t path = phist & ((1u << ((histLength[t] < ITTAGE_PHIST_BITS) ? histLength[t] : ITTAGE_PHIST_BITS)) - 1);
+    l->index[t] = (pc ^ (pc >> ITTAGE_LOG_ENTRIES) ^ indexFold[t].comp ^ path ^ (path >> ITTAGE_LOG_ENTRIES)) &
+                  ((1 << ITTAGE_LOG_ENTRIES) - 1);
+    l->tag[t] = ((pc ^ tagFold0[t].comp ^ (tagFold1[t].comp << 1)) & ((1 << tagBits[t]) - 1)) | 0x8000;
+    if (tables[t][l->index[t]].tag == l->tag[t])
+    {
+      if (l->provider < 0)
+        l->provider = t;
+      else if (alt < 0)
+        alt = t;
+    }
+  }
+
+  l->altTarget = (alt >= 0) ? tables[alt][l->index[alt]].target : base[l->baseIndex];
+  l->pred = l->altTarget;
+  if (l->provider >= 0)
+  {
+    const ittage_entry *e = &tables[l->provider][l->index[l->provider]];
+    if (e->conf > 0 || l->altTarget == 0)
+      l->pred = e->target;
+  }
+}
+
+uint32_t IttagePredictor::predict(uint32_t pc)
+{
+  lookup(pc);
+  return last.pred;
+}
+
+// Shift one bit into the global and path histories and every folded
+// history. The window slides down histBuf and is copied back to the top
+// when it reaches the bottom.
+void IttagePredictor::push_history(uint32_t pc, uint8_t bit)
+{
+  if (histPos == 0)
+  {
+    int window = histLength[numTables - 1] + 1;
+    histPos = ITTAGE_HIST_BUF - window;
+    memmove(histBuf + histPos, histBuf, window);
+  }
+  histBuf[--histPos] = bit;
+
+  const uint8_t *h = histBuf + histPos;
+  for (int t = 0; t < numTables; t++)
+  {
+    indexFold[t].update(h);
+    tagFold0[t].update(h);
+    tagFold1[t].update(h);
+  }
+  phist = ((phist << 1) ^ ((pc ^ (pc >> 4)) & 1)) & ((1u << ITTAGE_PHIST_BITS) - 1);
+}
+
+void IttagePredictor::train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  if (target_scored(ret, direct))
+  {
+    // Reuse the lookup of the prediction for this branch
+    if (!last.valid || last.pc != pc)
+      lookup(pc);
+    last.valid = 0;
+
+    ittage_lookup *l = &last;
+    int p = l->provider;
+    if (p >= 0)
+    {
+      ittage_entry *e = &tables[p][l->index[p]];
+      int providerRight = (e->target == target);
+
+      // Useful when it is right where the alternate is wrong
+      if (providerRight != (l->altTarget == target))
+        e->u = providerRight;
+
+      // Confirm the target, or replace it once confidence runs out
+      if (providerRight)
+      {
+        if (e->conf < ITTAGE_CONF_MAX)
+          e->conf++;
+      }
+      else if (e->conf > 0)
+        e->conf--;
+      else
+        e->target = target;
+    }
+    if (p < 0 || tables[p][l->index[p]].conf == 0)
+      base[l->baseIndex] = target;
+
+    // Allocate on misprediction in the first longer table with an entry
+    // that is not useful, clearing usefulness if there is none
+    if (l->pred != target && p < numTables - 1)
+    {
+      int t;
+      for (t = p + 1; t < numTables; t++)
+      {
+        ittage_entry *e = &tables[t][l->index[t]];
+        if (!e->u)
+        {
+          e->tag = l->tag[t];
+          e->target = target;
+          e->conf = 0;
+          break;
+        }
+      }
+      if (t == numTables)
+      {
+        for (t = p + 1; t < numTables; t++)
+          tables[t][l->index[t]].u = 0;
+      }
+    }
+
+    // Periodically clear every usefulness bit
+    if (++scored % ITTAGE_U_PERIOD == 0)
+    {
+      for (int t = 0; t < numTables; t++)
+        for (int i = 0; i < (1 << ITTAGE_LOG_ENTRIES); i++)
+          tables[t][i].u = 0;
+    }
+  }
+
+  // Conditional branches add their outcome, the others a bit of their
+  // target, so the history tells apart the paths that lead to a branch
+  if (condition)
+    push_history(pc, outcome);
+  else
+    push_history(pc, ((target >> 2) ^ (target >> 5)) & 1);
+}
+
+TargetPredictor *create_target_predictor(const target_config *cfg)
+{
+  switch (cfg->type)
+  {
+  case TARGET_BTB:
+    return new BtbTargetPredictor(cfg->logEntries);
+  case TARGET_ITTAGE:
+    return new IttagePredictor(cfg->numTables, cfg->minHistory, cfg->maxHistory);
+  default:
+    return NULL;
+  }
+}
+
+//------------------------------------//
+//        Return Address Stack        //
+//------------------------------------//
+
+// A return lands on the instruction after its call. The traces give the
+// call's PC but not its length, so any target within the longest x86
+// instruction past the call counts as a hit.
+#define RAS_MAX_CALL_BYTES 15
+
+static const char *rasOverflowNames[] = {"wrap", "drop"};
+static const char *rasRepairNames[] = {"none", "tos", "top", "full"};
+
+// Match the keyword at 'p' against 'names'
+//
+// Returns its index, -1 if none matches
+//
+static int parse_keyword(const char *p, size_t len, const char **names, int n)
+{
+  for (int i = 0; i < n; i++)
+  {
+    if (strlen(names[i]) == len && !strncmp(p, names[i], len))
+      return i;
+  }
+  return -1;
+}
+
+int parse_ras_config(const char *spec, ras_config *cfg)
+{
+  cfg->depth = 16;
+  cfg->overflow = RAS_WRAP;
+  cfg->repair = RAS_REPAIR_TOP;
+  cfg->wrongPath = 8;
+
+  char *end;
+  cfg->depth = strtol(spec, &end, 10);
+  if (end == spec || cfg->depth < 1 || cfg->depth > 4096)
+    return 0;
+
+  const char *p = end;
+  for (int f = 0; *p == ':'; f++)
+  {
+    p++;
+    size_t len = strcspn(p, ":");
+    if (f == 0)
+      cfg->overflow = parse_keyword(p, len, rasOverflowNames, 2);
+    else if (f == 1)
+      cfg->repair = parse_keyword(p, len, rasRepairNames, 4);
+    else if (f == 2)
+    {
+      cfg->wrongPath = strtol(p, &end, 10);
+      if (end != p + len || cfg->wrongPath < 0 || cfg->wrongPath > RAS_MAX_WRONG_PATH)
+        return 0;
+    }
+    else
+      return 0;
+    if (cfg->overflow < 0 || cfg->repair < 0)
+      return 0;
+    p += len;
+  }
+  return *p == '\0';
+}
+
+ReturnStack::ReturnStack(const ras_config *cfg)
+{
+  this->cfg = *cfg;
+  entries = (uint32_t *)calloc(cfg->depth, sizeof(uint32_t));
+  checkpoint = (uint32_t *)malloc(cfg->depth * sizeof(uint32_t));
+  tos = 0;
+  count = 0;
+  numRecent = 0;
+  recentPos = 0;
+}
+
+ReturnStack::~ReturnStack()
+{
+  free(entries);
+  free(checkpoint);
+}
+
+void ReturnStack::push(uint32_t pc)
+{
+  if (cfg.overflow == RAS_DROP && count == cfg.depth)
+    return;
+  tos = (tos + 1) % cfg.depth;
+  entries[tos] = pc;
+  if (count < cfg.depth)
+    count++;
+}
+
+// A circular stack pops past its bottom into stale entries, as the
+// hardware would; a bounded one stays empty
+void ReturnStack::pop()
+{
+  if (cfg.overflow == RAS_DROP && count == 0)
+    return;
+  tos = (tos + cfg.depth - 1) % cfg.depth;
+  if (count > 0)
+    count--;
+}
+
+int ReturnStack::predict(uint32_t target)
+{
+  if (cfg.overflow == RAS_DROP && count == 0)
+    return 0;
+  uint32_t call = entries[tos];
+  return target > call && target - call <= RAS_MAX_CALL_BYTES;
+}
+
+void ReturnStack::train(uint32_t pc, uint32_t call, uint32_t ret)
+{
+  if (call)
+    push(pc);
+  else if (ret)
+    pop();
+  else
+    return;
+
+  if (cfg.wrongPath > 0)
+  {
+    recent[recentPos] = call ? pc : 0;
+    recentPos = (recentPos + 1) % cfg.wrongPath;
+    if (numRecent < cfg.wrongPath)
+      numRecent++;
+  }
+}
+
+void ReturnStack::mispredict()
+{
+  int savedTos = tos;
+  int savedCount = count;
+  uint32_t savedTop = entries[tos];
+  if (cfg.repair == RAS_REPAIR_FULL)
+    memcpy(checkpoint, entries, cfg.depth * sizeof(uint32_t));
+
+  // Wrong path: the recent calls and returns, oldest first
+  for (int k = 0; k < numRecent; k++)
+  {
+    uint32_t op = recent[(recentPos + cfg.wrongPath - numRecent + k) % cfg.wrongPath];
+    if (op)
+      push(op);
+    else
+      pop();
+  }
+
+  switch (cfg.repair)
+  {
+  case RAS_REPAIR_FULL:
+    memcpy(entries, checkpoint, cfg.depth * sizeof(uint32_t));
+    // fall through
+  case RAS_REPAIR_TOS:
+    tos = savedTos;
+    count = savedCount;
+    break;
+  case RAS_REPAIR_TOP:
+    tos = savedTos;
+    count = savedCount;
+    entries[tos] = savedTop;
+    break;
+  default:
+    break;
+  }
+}
+
+//------------------------------------//
+//       Branch Target Buffer         //
+//------------------------------------//
+
+#define BTB_RRPV_MAX 3          // 2-bit SRRIP values
+#define BTB_RRPV_INSERT 2       // Inserted with a long re-reference interval
+
+static const char *btbPolicyNames[] = {"lru", "srrip", "random"};
+
+int parse_btb_config(const char *spec, btb_config *cfg)
+{
+  cfg->ways = 4;
+  cfg->tagBits = 16;
+  cfg->policy = BTB_LRU;
+
+  int *fields[3] = {&cfg->entries, &cfg->ways, &cfg->tagBits};
+  const char *p = spec;
+  char *end;
+  for (int f = 0; f < 4; f++)
+  {
+    size_t len = strcspn(p, ":");
+    if (f < 3)
+    {
+      *fields[f] = strtol(p, &end, 10);
+      if (end == p || end != p + len)
+        return 0;
+    }
+    else
+    {
+      cfg->policy = parse_keyword(p, len, btbPolicyNames, 3);
+      if (cfg->policy < 0)
+        return 0;
+    }
+    p += len;
+    if (*p != ':')
+      break;
+    p++;
+  }
+  if (*p != '\0')
+    return 0;
+
+  int sets = (cfg->ways > 0) ? cfg->entries / cfg->ways : 0;
+  return sets > 0 && sets * cfg->ways == cfg->entries && (sets & (sets - 1)) == 0 &&
+         cfg->tagBits >= 1 && cfg->tagBits <= 32;
+}
+
+BranchTargetBuffer::BranchTargetBuffer(const btb_config *cfg)
+{
+  this->cfg = *cfg;
+  numSets = cfg->entries / cfg->ways;
+  entries = (btb_entry *)calloc(cfg->entries, sizeof(btb_entry));
+  clock = 0;
+  seed = 0x2545F491;
+}
+
+BranchTargetBuffer::~BranchTargetBuffer()
+{
+  free(entries);
+}
+
+// Choose the entry of 'set' to replace, preferring an invalid one
+btb_entry *BranchTargetBuffer::victim(btb_entry *set)
+{
+  for (int w = 0; w < cfg.ways; w++)
+  {
+    if (!set[w].valid)
+      return &set[w];
+  }
+
+  switch (cfg.policy)
+  {
+  case BTB_SRRIP:
+    // Age the set until some entry is predicted re-referenced last
+    for (;;)
+    {
+      for (int w = 0; w < cfg.ways; w++)
+      {
+        if (set[w].rrpv == BTB_RRPV_MAX)
+          return &set[w];
+      }
+      for (int w = 0; w < cfg.ways; w++)
+        set[w].rrpv++;
+    }
+  case BTB_RANDOM:
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return &set[seed % cfg.ways];
+  default:
+  {
+    btb_entry *lru = &set[0];
+    for (int w = 1; w < cfg.ways; w++)
+    {
+      if (set[w].lastUse < lru->lastUse)
+        lru = &set[w];
+    }
+    return lru;
+  }
+  }
+}
+
+int BranchTargetBuffer::access(uint32_t pc, uint32_t target, uint32_t ret)
+{
+  uint32_t index = pc & (numSets - 1);
+  uint32_t tag = (pc / numSets) & (uint32_t)((1ULL << cfg.tagBits) - 1);
+  btb_entry *set = &entries[index * cfg.ways];
+  clock++;
+
+  btb_entry *e = NULL;
+  for (int w = 0; w < cfg.ways; w++)
+  {
+    if (set[w].valid && set[w].tag == tag)
+    {
+      e = &set[w];
+      break;
+    }
+  }
+
+  int hit = (e != NULL && (ret || e->target == target));
+  if (e != NULL)
+    e->rrpv = 0;
+  else
+  {
+    e = victim(set);
+    e->valid = 1;
+    e->tag = tag;
+    e->rrpv = BTB_RRPV_INSERT;
+  }
+  e->target = target;
+  e->lastUse = clock;
+  return hit;
+}
@@ -0,0 +1,200 @@
+//========================================================//
+//  target.h                                              //
+//  Header file for branch target prediction              //
+//                                                        //
+//  Target predictors guess where indirect jumps and      //
+//  calls go; they run beside the direction predictor     //
+//========================================================//
+
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <stdint.h>
+
+// The different target predictor types
+#define TARGET_NONE 0
+#define TARGET_BTB 1
+#define TARGET_ITTAGE 2
+
+// A target predictor type together with its sizes
+typedef struct
+{
+  int type;
+  int logEntries;  // BTB entries
+  int numTables;   // ITTAGE tagged tables
+  int minHistory;  // ITTAGE shortest and longest history
+  int maxHistory;
+} target_config;
+
+// A target predictor instance owning its tables and history
+//
+class TargetPredictor
+{
+public:
+  virtual ~TargetPredictor() {}
+
+  // Predict the target of the indirect branch at PC 'pc'
+  //
+  // Returns the predicted target, 0 if there is none
+  //
+  virtual uint32_t predict(uint32_t pc) = 0;
+
+  // Train with every record of the trace, so the histories see all
+  // branches; only indirect branches that are not returns train tables
+  //
+  virtual void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct) = 0;
+};
+
+// True for the records target prediction is scored on: indirect jumps
+// and calls. Returns are left to a return address stack.
+//
+static inline int target_scored(uint32_t ret, uint32_t direct)
+{
+  return !direct && !ret;
+}
+
+//------------------------------------//
+//        Return Address Stack        //
+//------------------------------------//
+
+// Overflow policies: a circular stack overwrites its oldest entry, a
+// bounded one drops the push
+#define RAS_WRAP 0
+#define RAS_DROP 1
+
+// What is restored after the wrong path of a mispredicted branch: nothing,
+// the top of stack pointer, the pointer and the top entry, or everything
+#define RAS_REPAIR_NONE 0
+#define RAS_REPAIR_TOS 1
+#define RAS_REPAIR_TOP 2
+#define RAS_REPAIR_FULL 3
+
+// Entries of the wrong-path window
+#define RAS_MAX_WRONG_PATH 64
+
+typedef struct
+{
+  int depth;      // Entries, 0 if the stack is off
+  int overflow;   // RAS_WRAP or RAS_DROP
+  int repair;     // RAS_REPAIR_*
+  int wrongPath;  // Records the wrong path of a misprediction runs for
+} ras_config;
+
+// A return address stack. The traces hold no wrong-path records, so the
+// wrong path of a mispredicted branch is modeled by replaying the calls
+// and returns of the last 'wrongPath' records onto the stack before it
+// is repaired.
+//
+class ReturnStack
+{
+public:
+  ReturnStack(const ras_config *cfg);
+  ~ReturnStack();
+
+  // Predict the target of a return
+  //
+  // Returns True if the top entry is the call that 'target' returns past
+  //
+  int predict(uint32_t target);
+
+  // Push calls and pop returns, for every record of the trace
+  //
+  void train(uint32_t pc, uint32_t call, uint32_t ret);
+
+  // Run the wrong path of a mispredicted branch, then repair the stack
+  //
+  void mispredict();
+
+private:
+  void push(uint32_t pc);
+  void pop();
+
+  ras_config cfg;
+  uint32_t *entries;   // Call PCs
+  uint32_t *checkpoint; // Copy of entries for RAS_REPAIR_FULL
+  int tos;             // Index of the top entry
+  int count;           // Valid entries, for RAS_DROP
+  uint32_t recent[RAS_MAX_WRONG_PATH]; // Recent calls (PC) and returns (0)
+  int numRecent;
+  int recentPos;
+};
+
+// Parse "<depth>[:<overflow>[:<repair>[:<wrongpath>]]]", with overflow
+// "wrap" or "drop" and repair "none", "tos", "top" or "full"
+//
+// Returns True if Successful
+//
+int parse_ras_config(const char *spec, ras_config *cfg);
+
+//------------------------------------//
+//       Branch Target Buffer         //
+//------------------------------------//
+
+// Replacement policies
+#define BTB_LRU 0
+#define BTB_SRRIP 1
+#define BTB_RANDOM 2
+
+typedef struct
+{
+  int entries;   // 0 if the BTB is off
+  int ways;
+  int tagBits;   // Partial tags alias, and an aliased hit is a miss
+  int policy;    // BTB_LRU, BTB_SRRIP or BTB_RANDOM
+} btb_config;
+
+struct btb_entry {
+    uint8_t valid;
+    uint8_t rrpv;       // SRRIP re-reference prediction value
+    uint32_t tag;
+    uint32_t target;
+    uint64_t lastUse;   // LRU stamp
+};
+
+// A set-associative branch target buffer holding the targets of taken
+// branches of every kind
+//
+class BranchTargetBuffer
+{
+public:
+  BranchTargetBuffer(const btb_config *cfg);
+  ~BranchTargetBuffer();
+
+  // Look up the taken branch at 'pc', then insert or update its entry.
+  // Returns take their target from the return address stack, so they
+  // only need to be found.
+  //
+  // Returns True if the BTB supplied 'target'
+  //
+  int access(uint32_t pc, uint32_t target, uint32_t ret);
+
+private:
+  btb_entry *victim(btb_entry *set);
+
+  btb_config cfg;
+  int numSets;
+  btb_entry *entries;
+  uint64_t clock;
+  uint32_t seed;
+};
+
+// Parse "<entries>[:<ways>[:<tagbits>[:<policy>]]]", with policy "lru",
+// "srrip" or "random"; entries must be a power of two multiple of ways
+//
+// Returns True if Successful
+//
+int parse_btb_config(const char *spec, btb_config *cfg);
+
+// Parse "btb[:<log2 entries>]" or "ittage[:<tables>[:<minhist>[:<maxhist>]]]"
+//
+// Returns True if Successful
+//
+int parse_target_config(const char *spec, target_config *cfg);
+
+// Create a target predictor for 'cfg'
+//
+// Returns NULL if cfg->type is unknown
+//
+TargetPredictor *create_target_predictor(const target_config *cfg);
+
+#endif
@@ -0,0 +1,626 @@
+//========================================================//
+//  trace.cpp                                             //
+//  Source file for branch trace formats                  //
+//                                                        //
+//  Opening, format detection and decoding of text and    //
+//  binary traces                                         //
+//========================================================//
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "trace.h"
+
+// Decoder thread, at the end of the file
+static void stop_decoder(trace_reader *t);
+static size_t decoder_next(trace_reader *t);
+
+static void put_le16(uint8_t *dst, uint16_t v)
+{
+  dst[0] = v & 0xff;
+  dst[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *dst, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    dst[i] = (v >> (8 * i)) & 0xff;
+}
+
+static uint16_t get_le16(const uint8_t *src)
+{
+  return (uint16_t)(src[0] | (src[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *src)
+{
+  return (uint32_t)src[0] | ((uint32_t)src[1] << 8) |
+         ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+// Validate a binary header and extract its record count
+//
+// Returns True if Successful
+//
+static int parse_header(const uint8_t *header, uint64_t *num_records)
+{
+  if (memcmp(header, TRACE_MAGIC, TRACE_MAGIC_BYTES))
+  {
+    fprintf(stderr, "Error: malformed binary trace header\n");
+    return 0;
+  }
+  if (get_le16(header + 4) != TRACE_VERSION ||
+      get_le16(header + 6) != TRACE_RECORD_BYTES)
+  {
+    fprintf(stderr, "Error: unsupported binary trace version %d\n",
+            get_le16(header + 4));
+    return 0;
+  }
+  *num_records = (uint64_t)get_le32(header + 8) |
+                 ((uint64_t)get_le32(header + 12) << 32);
+  return 1;
+}
+
+// Point the reader at decoded bytes [data, data + len). Mapped files are
+// decoded to the very end; a decompressed block only up to its last
+// whole record, the rest is stitched to the next block.
+//
+static void set_span(trace_reader *t, const uint8_t *data, size_t len)
+{
+  t->cur = data;
+  t->chunk_end = data + len;
+  t->end = t->chunk_end;
+  if (t->bz2 == NULL)
+  {
+    return;
+  }
+  if (t->format == TRACE_BINARY)
+  {
+    t->end = data + len - len % TRACE_RECORD_BYTES;
+  }
+  else
+  {
+    const uint8_t *nl = (const uint8_t *)memrchr(data, '\n', len);
+    t->end = nl ? nl + 1 : data;
+  }
+}
+
+// Detect the format of the first decoded bytes and point the reader
+// past the binary header if present
+//
+// Returns True if Successful
+//
+static int start_span(trace_reader *t, const uint8_t *data, size_t len)
+{
+  t->format = TRACE_TEXT;
+  if (len > 0 && data[0] == (uint8_t)TRACE_MAGIC[0])
+  {
+    t->format = TRACE_BINARY;
+    if (len < TRACE_HEADER_BYTES || !parse_header(data, &t->num_records))
+    {
+      return 0;
+    }
+    data += TRACE_HEADER_BYTES;
+    len -= TRACE_HEADER_BYTES;
+  }
+  set_span(t, data, len);
+  return 1;
+}
+
+// Map the regular file behind 'fd' and detect its format
+//
+// Returns True if Successful, False if the file cannot be mapped and -1
+// if it is not a valid trace
+//
+static int map_trace(trace_reader *t, int fd, int threads)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+  {
+    return 0;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    return 0;
+  }
+  // The trace is consumed front to back exactly once
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  madvise(map, st.st_size, MADV_HUGEPAGE);
+#endif
+  t->map = (const uint8_t *)map;
+  t->map_len = st.st_size;
+
+  if (!bz2_is_compressed(t->map, t->map_len))
+  {
+    return start_span(t, t->map, t->map_len) ? 1 : -1;
+  }
+
+  const uint8_t *chunk = NULL;
+  size_t len = 0;
+  t->bz2 = bz2_open(t->map, t->map_len, threads);
+  if (t->bz2 == NULL || bz2_next(t->bz2, &chunk, &len) < 0)
+  {
+    fprintf(stderr, "Error: corrupt bzip2 trace\n");
+    return -1;
+  }
+  return start_span(t, chunk, len) ? 1 : -1;
+}
+
+// Detect the format of a stream, consuming the binary header if present
+//
+// Returns True if Successful
+//
+static int open_stream(trace_reader *t)
+{
+  t->format = TRACE_TEXT;
+
+  // Text traces always start with "0x", binary ones with a non-ASCII byte
+  int c = getc(t->stream);
+  if (c == EOF)
+  {
+    return 1;
+  }
+  ungetc(c, t->stream);
+  if (c == 'B')
+  {
+    fprintf(stderr, "Error: pass bzip2 traces by path or through bunzip2\n");
+    return 0;
+  }
+  if (c != (uint8_t)TRACE_MAGIC[0])
+  {
+    return 1;
+  }
+
+  uint8_t header[TRACE_HEADER_BYTES];
+  t->format = TRACE_BINARY;
+  if (fread(header, 1, TRACE_HEADER_BYTES, t->stream) != TRACE_HEADER_BYTES)
+  {
+    fprintf(stderr, "Error: malformed binary trace header\n");
+    return 0;
+  }
+  return parse_header(header, &t->num_records);
+}
+
+int trace_open(trace_reader *t, const char *path, int threads)
+{
+  memset(t, 0, sizeof(*t));
+  t->out = t->buf;
+  t->recs = t->buf;
+
+  if (path == NULL || !strcmp(path, "-"))
+  {
+    t->stream = stdin;
+    return open_stream(t);
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    fprintf(stderr, "Error: cannot open %s\n", path);
+    return 0;
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  int mapped = map_trace(t, fd, threads);
+  if (mapped != 0)
+  {
+    close(fd);
+    return mapped > 0;
+  }
+
+  t->stream = fdopen(fd, "r");
+  return open_stream(t);
+}
+
+void trace_close(trace_reader *t)
+{
+  stop_decoder(t);
+  if (t->bz2 != NULL)
+  {
+    bz2_close(t->bz2);
+  }
+  if (t->map != NULL)
+  {
+    munmap((void *)t->map, t->map_len);
+  }
+  if (t->stream != NULL)
+  {
+    fclose(t->stream);
+  }
+  free(t->line);
+  free(t->carry);
+  t->bz2 = NULL;
+  t->carry = NULL;
+  t->map = NULL;
+  t->stream = NULL;
+  t->line = NULL;
+}
+
+int trace_write_header(FILE *stream, uint64_t num_records)
+{
+  uint8_t header[TRACE_HEADER_BYTES];
+  memcpy(header, TRACE_MAGIC, TRACE_MAGIC_BYTES);
+  put_le16(header + 4, TRACE_VERSION);
+  put_le16(header + 6, TRACE_RECORD_BYTES);
+  put_le32(header + 8, (uint32_t)num_records);
+  put_le32(header + 12, (uint32_t)(num_records >> 32));
+  return fwrite(header, 1, TRACE_HEADER_BYTES, stream) == TRACE_HEADER_BYTES;
+}
+
+void trace_pack(uint8_t *dst, const branch_record *rec)
+{
+  put_le32(dst, rec->pc);
+  put_le32(dst + 4, rec->target);
+  dst[8] = (rec->outcome ? TRACE_OUTCOME : 0) |
+           (rec->condition ? TRACE_CONDITION : 0) |
+           (rec->call ? TRACE_CALL : 0) |
+           (rec->ret ? TRACE_RET : 0) |
+           (rec->direct ? TRACE_DIRECT : 0);
+}
+
+void trace_unpack(const uint8_t *src, branch_record *rec)
+{
+  uint8_t flags = src[8];
+  rec->pc = get_le32(src);
+  rec->target = get_le32(src + 4);
+  rec->outcome = flags & TRACE_OUTCOME;
+  rec->condition = (flags >> 1) & 1;
+  rec->call = (flags >> 2) & 1;
+  rec->ret = (flags >> 3) & 1;
+  rec->direct = (flags >> 4) & 1;
+}
+
+// Decode whole records from [t->cur, t->end) into t->out[n...]
+//
+// Returns the new number of decoded records
+//
+static size_t decode_span(trace_reader *t, size_t n)
+{
+  if (t->format == TRACE_BINARY)
+  {
+    size_t avail = (t->end - t->cur) / TRACE_RECORD_BYTES;
+    size_t take = (avail < TRACE_BATCH - n) ? avail : TRACE_BATCH - n;
+    for (size_t i = 0; i < take; i++)
+    {
+      trace_unpack(t->cur + i * TRACE_RECORD_BYTES, &t->out[n + i]);
+    }
+    t->cur += take * TRACE_RECORD_BYTES;
+    return n + take;
+  }
+
+  const char *p = (const char *)t->cur;
+  const char *end = (const char *)t->end;
+  while (n < TRACE_BATCH && p < end)
+  {
+    int ok;
+    p = trace_parse_text(p, end, &t->out[n], &ok);
+    n += ok;
+  }
+  t->cur = (const uint8_t *)p;
+  return n;
+}
+
+static void append_carry(trace_reader *t, const uint8_t *data, size_t len)
+{
+  if (t->carry_len + len > t->carry_cap)
+  {
+    t->carry_cap = 2 * (t->carry_len + len);
+    t->carry = (uint8_t *)realloc(t->carry, t->carry_cap);
+  }
+  memcpy(t->carry + t->carry_len, data, len);
+  t->carry_len += len;
+}
+
+// Decode the record held in t->carry into t->out[*n]
+//
+static void decode_carry(trace_reader *t, size_t *n)
+{
+  int ok = 0;
+  if (t->format == TRACE_BINARY)
+  {
+    ok = (t->carry_len == TRACE_RECORD_BYTES);
+    if (ok)
+      trace_unpack(t->carry, &t->out[*n]);
+  }
+  else
+  {
+    trace_parse_text((const char *)t->carry, (const char *)t->carry + t->carry_len,
+                     &t->out[*n], &ok);
+  }
+  *n += ok;
+  t->carry_len = 0;
+}
+
+// Move on to the next decompressed block, decoding the record that
+// straddles the boundary into t->out[*n]
+//
+// Returns True if a block is available
+//
+static int next_chunk(trace_reader *t, size_t *n)
+{
+  append_carry(t, t->cur, t->chunk_end - t->cur);
+
+  for (;;)
+  {
+    const uint8_t *data;
+    size_t len;
+    int r = bz2_next(t->bz2, &data, &len);
+    if (r <= 0)
+    {
+      if (r < 0)
+        fprintf(stderr, "Error: corrupt bzip2 trace, stopping early\n");
+      if (t->carry_len > 0)
+        decode_carry(t, n);
+      t->cur = t->end = t->chunk_end = NULL;
+      return 0;
+    }
+
+    // Complete the straddling record from the front of the new block
+    if (t->carry_len > 0)
+    {
+      size_t take;
+      int complete;
+      if (t->format == TRACE_BINARY)
+      {
+        take = TRACE_RECORD_BYTES - t->carry_len;
+        complete = (take <= len);
+        take = complete ? take : len;
+      }
+      else
+      {
+        const uint8_t *nl = (const uint8_t *)memchr(data, '\n', len);
+        complete = (nl != NULL);
+        take = complete ? nl + 1 - data : len;
+      }
+      append_carry(t, data, take);
+      if (!complete)
+        continue;
+      decode_carry(t, n);
+      data += take;
+      len -= take;
+    }
+
+    set_span(t, data, len);
+    return 1;
+  }
+}
+
+// Decode a batch from a stdio stream
+//
+static size_t fill_stream(trace_reader *t)
+{
+  size_t n = 0;
+
+  if (t->format == TRACE_BINARY)
+  {
+    uint8_t raw[TRACE_BATCH * TRACE_RECORD_BYTES];
+    n = fread(raw, TRACE_RECORD_BYTES, TRACE_BATCH, t->stream);
+    for (size_t i = 0; i < n; i++)
+    {
+      trace_unpack(raw + i * TRACE_RECORD_BYTES, &t->out[i]);
+    }
+    return n;
+  }
+
+  ssize_t len;
+  while (n < TRACE_BATCH && (len = getline(&t->line, &t->line_len, t->stream)) != -1)
+  {
+    int ok;
+    trace_parse_text(t->line, t->line + len, &t->out[n], &ok);
+    n += ok;
+  }
+  return n;
+}
+
+// Decode the next batch into t->out
+//
+// Returns the number of records decoded, 0 at end of trace
+//
+static size_t decode_batch(trace_reader *t)
+{
+  if (t->map == NULL)
+  {
+    return fill_stream(t);
+  }
+
+  size_t n = decode_span(t, 0);
+  while (t->bz2 != NULL && n < TRACE_BATCH && t->cur != NULL && next_chunk(t, &n))
+  {
+    n = decode_span(t, n);
+  }
+  return n;
+}
+
+size_t trace_fill(trace_reader *t)
+{
+  t->pos = 0;
+  if (t->decoder != NULL)
+  {
+    t->count = decoder_next(t);
+    return t->count;
+  }
+  t->count = decode_batch(t);
+  return t->count;
+}
+
+//------------------------------------//
+//           Decoder Thread           //
+//------------------------------------//
+
+// Single-producer, single-consumer ring of decoded batches. The decoder
+// only advances 'tail' and the simulation only 'head', each publishing
+// with a release store the other reads with an acquire load, so neither
+// takes a lock while the ring is neither full nor empty. A side that
+// has to wait spins briefly, then sets its waiting flag and sleeps on
+// 'cond'; the other side takes the lock only to wake a flagged waiter.
+// A batch of 0 records marks the end of the trace.
+struct trace_decoder
+{
+  struct
+  {
+    branch_record recs[TRACE_BATCH];
+    size_t count;
+  } slots[TRACE_DECODER_SLOTS];
+  alignas(64) uint64_t head; // Next batch to consume
+  int holding;               // The consumer still reads batch 'head'
+  int consumerWaiting;       // The simulation sleeps until 'tail' moves
+  alignas(64) uint64_t tail; // Next batch to decode
+  int producerWaiting;       // The decoder sleeps until 'head' moves
+  int stop;                  // Set when the trace is closed early
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t thread;
+};
+
+#define DECODER_SPINS 64
+
+// Spin briefly on the other side of the ring
+//
+// Returns True while the caller should keep spinning rather than sleep
+//
+static inline int decoder_spin(int *spins)
+{
+  if (++*spins > DECODER_SPINS)
+    return 0;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+  return 1;
+}
+
+static int decoder_has_space(trace_decoder *d)
+{
+  return d->tail - __atomic_load_n(&d->head, __ATOMIC_ACQUIRE) != TRACE_DECODER_SLOTS ||
+         __atomic_load_n(&d->stop, __ATOMIC_RELAXED);
+}
+
+static int decoder_has_batch(trace_decoder *d)
+{
+  return __atomic_load_n(&d->tail, __ATOMIC_ACQUIRE) != d->head;
+}
+
+// Sleep until 'ready' holds. The flag is raised before 'ready' is checked
+// again, and the other side reads it after publishing, with a full fence
+// on both sides, so at least one of them sees the other's store and no
+// wakeup is lost.
+static void decoder_park(trace_decoder *d, int *waiting, int (*ready)(trace_decoder *))
+{
+  pthread_mutex_lock(&d->lock);
+  __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  while (!ready(d))
+    pthread_cond_wait(&d->cond, &d->lock);
+  __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&d->lock);
+}
+
+// Wake the other side if it sleeps, after a store it waits for
+static void decoder_wake(trace_decoder *d, int *waiting)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiting, __ATOMIC_RELAXED))
+  {
+    pthread_mutex_lock(&d->lock);
+    pthread_cond_signal(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+  }
+}
+
+static void *decoder_main(void *arg)
+{
+  trace_reader *t = (trace_reader *)arg;
+  trace_decoder *d = t->decoder;
+
+  for (uint64_t tail = d->tail;; tail++)
+  {
+    // Backpressure: wait for the consumer to free a slot
+    int spins = 0;
+    while (!decoder_has_space(d))
+    {
+      if (!decoder_spin(&spins))
+        decoder_park(d, &d->producerWaiting, decoder_has_space);
+    }
+    if (__atomic_load_n(&d->stop, __ATOMIC_RELAXED))
+      return NULL;
+
+    int s = tail % TRACE_DECODER_SLOTS;
+    t->out = d->slots[s].recs;
+    size_t n = decode_batch(t);
+    d->slots[s].count = n;
+    __atomic_store_n(&d->tail, tail + 1, __ATOMIC_RELEASE);
+    decoder_wake(d, &d->consumerWaiting);
+    if (n == 0)
+      return NULL;
+  }
+}
+
+int trace_start_decoder(trace_reader *t)
+{
+  trace_decoder *d = (trace_decoder *)aligned_alloc(64, sizeof(trace_decoder));
+  memset(d, 0, sizeof(*d));
+  pthread_mutex_init(&d->lock, NULL);
+  pthread_cond_init(&d->cond, NULL);
+  t->decoder = d;
+  t->pos = t->count = 0;
+  if (pthread_create(&d->thread, NULL, decoder_main, t) != 0)
+  {
+    t->decoder = NULL;
+    t->out = t->buf;
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->cond);
+    free(d);
+    return 0;
+  }
+  return 1;
+}
+
+// Hand the batch read so far back to the decoder and wait for the next
+//
+// Returns the number of records in t->recs, 0 at end of trace
+//
+static size_t decoder_next(trace_reader *t)
+{
+  trace_decoder *d = t->decoder;
+  if (d->holding)
+  {
+    __atomic_store_n(&d->head, d->head + 1, __ATOMIC_RELEASE);
+    d->holding = 0;
+    decoder_wake(d, &d->producerWaiting);
+  }
+
+  int spins = 0;
+  while (!decoder_has_batch(d))
+  {
+    if (!decoder_spin(&spins))
+      decoder_park(d, &d->consumerWaiting, decoder_has_batch);
+  }
+
+  int s = d->head % TRACE_DECODER_SLOTS;
+  t->recs = d->slots[s].recs;
+  if (d->slots[s].count == 0)
+    return 0;
+  d->holding = 1;
+  return d->slots[s].count;
+}
+
+static void stop_decoder(trace_reader *t)
+{
+  trace_decoder *d = t->decoder;
+  if (d == NULL)
+    return;
+  __atomic_store_n(&d->stop, 1, __ATOMIC_RELAXED);
+  decoder_wake(d, &d->producerWaiting);
+  pthread_join(d->thread, NULL);
+  pthread_mutex_destroy(&d->lock);
+  pthread_cond_destroy(&d->cond);
+  free(d);
+  t->decoder = NULL;
+  t->out = t->buf;
+  t->recs = t->buf;
+}
@@ -0,0 +1,167 @@
+//========================================================//
+//  trace.h                                               //
+//  Header file for branch trace formats                  //
+//                                                        //
+//  Text traces hold one tab-separated record per line    //
+//  as emitted by branchExtractor. Binary traces hold     //
+//  fixed-width packed records behind a short header.     //
+//========================================================//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "bz2_decoder.h"
+
+//------------------------------------//
+//          Trace Formats             //
+//------------------------------------//
+#define TRACE_TEXT 0
+#define TRACE_BINARY 1
+
+// Binary trace header (all fields little-endian):
+//   bytes 0-3   magic "\x89BPT"
+//   bytes 4-5   format version
+//   bytes 6-7   bytes per record
+//   bytes 8-15  number of records (0 if unknown, e.g. written to a pipe)
+#define TRACE_MAGIC "\x89" "BPT"
+#define TRACE_MAGIC_BYTES 4
+#define TRACE_HEADER_BYTES 16
+#define TRACE_VERSION 1
+
+// Binary record: 32-bit PC, 32-bit target, 1 byte of flags
+#define TRACE_RECORD_BYTES 9
+
+// Flag bits of a binary record
+#define TRACE_OUTCOME   0x01
+#define TRACE_CONDITION 0x02
+#define TRACE_CALL      0x04
+#define TRACE_RET       0x08
+#define TRACE_DIRECT    0x10
+
+// Text record parsers
+#define PARSE_SCALAR 0
+#define PARSE_SSE2 1
+#define PARSE_AVX2 2
+extern const char *parserName[];
+extern int traceParser; // Parser in use, the fastest the CPU supports by default
+
+// Number of records decoded per refill of a trace_reader
+#define TRACE_BATCH 4096
+
+// Batches a decoder thread may run ahead of the simulation
+#define TRACE_DECODER_SLOTS 8
+
+// A decoded branch record
+typedef struct
+{
+  uint32_t pc;
+  uint32_t target;
+  uint8_t outcome;
+  uint8_t condition;
+  uint8_t call;
+  uint8_t ret;
+  uint8_t direct;
+} branch_record;
+
+// Ring of decoded batches between a decoder thread and the simulation
+struct trace_decoder;
+
+// An open trace. Regular files are memory-mapped and decoded in place,
+// bzip2 files are decompressed block-parallel and decoded one block at a
+// time; pipes fall back to buffered stdio reads.
+typedef struct
+{
+  int format;
+  uint64_t num_records;     // From the binary header, 0 if unknown
+  FILE *stream;             // NULL when the trace is memory-mapped
+  char *line;               // getline buffer for text streams
+  size_t line_len;
+  const uint8_t *map;       // Mapping of the whole file
+  size_t map_len;
+  bz2_decoder *bz2;         // Set when the mapping is bzip2 compressed
+  const uint8_t *cur;       // Next undecoded byte of the mapping or block
+  const uint8_t *end;       // End of the whole records in it
+  const uint8_t *chunk_end; // End of the decompressed block
+  uint8_t *carry;           // Record straddling two decompressed blocks
+  size_t carry_len;
+  size_t carry_cap;
+  branch_record buf[TRACE_BATCH]; // Batch decoded on the calling thread
+  branch_record *out;       // Where the next batch is decoded
+  const branch_record *recs; // Batch being consumed
+  size_t pos;
+  size_t count;
+  trace_decoder *decoder;   // Set while a thread decodes ahead
+} trace_reader;
+
+//------------------------------------//
+//      Trace Function Prototypes     //
+//------------------------------------//
+
+// Open the trace at 'path' ("-" or NULL for stdin) and detect its format,
+// decompressing bzip2 files on 'threads' worker threads
+//
+// Returns True if Successful
+//
+int trace_open(trace_reader *t, const char *path, int threads);
+
+// Decode the next batch of records into t->recs
+//
+// Returns the number of records decoded, 0 at end of trace
+//
+size_t trace_fill(trace_reader *t);
+
+// Release the mapping or stream and buffers of 't', stopping its decoder
+// thread if any
+//
+void trace_close(trace_reader *t);
+
+// Decode the rest of 't' on a thread of its own, up to
+// TRACE_DECODER_SLOTS batches ahead. trace_fill() then takes each batch
+// from the ring the thread fills, so decoding overlaps the simulation.
+//
+// Returns True if Successful
+//
+int trace_start_decoder(trace_reader *t);
+
+// Fetch the next record of 't'
+//
+// Returns True if Successful
+//
+static inline int trace_next(trace_reader *t, branch_record *rec)
+{
+  if (t->pos == t->count && trace_fill(t) == 0)
+  {
+    return 0;
+  }
+  *rec = t->recs[t->pos++];
+  return 1;
+}
+
+// Write a binary header announcing 'num_records' records
+//
+// Returns True if Successful
+//
+int trace_write_header(FILE *stream, uint64_t num_records);
+
+// Parse one text record (a line of branchExtractor output) starting at
+// 'p', reading no further than 'end', with the selected parser
+//
+// Returns a pointer past the line's newline, with 'ok' set to whether the
+// line held a well-formed record
+//
+const char *trace_parse_text(const char *p, const char *end, branch_record *rec, int *ok);
+
+// Switch text parsing to parser 'kind'
+//
+// Returns True if the parser is supported on this machine
+//
+int trace_select_parser(int kind);
+
+// Pack a record into TRACE_RECORD_BYTES bytes at 'dst' and back
+//
+void trace_pack(uint8_t *dst, const branch_record *rec);
+void trace_unpack(const uint8_t *src, branch_record *rec);
+
+#endif
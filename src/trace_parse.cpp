@@ -0,0 +1,322 @@
+//========================================================//
+//  trace_parse.cpp                                       //
+//  Source file for the text trace record parsers         //
+//                                                        //
+//  A scalar parser defines the accepted syntax; SSE2     //
+//  and AVX2 parsers classify a 64-byte window at once    //
+//  and handle the common record shape, falling back to   //
+//  the scalar one for anything else                      //
+//========================================================//
+#include <string.h>
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRACE_PARSE_X86 1
+#endif
+
+const char *parserName[3] = {"Scalar", "SSE2", "AVX2"};
+
+//------------------------------------//
+//           Scalar Parser            //
+//------------------------------------//
+
+static const char *skip_blanks(const char *p, const char *end)
+{
+  while (p < end && (*p == '\t' || *p == ' '))
+    p++;
+  return p;
+}
+
+static const char *parse_hex(const char *p, const char *end, uint32_t *v, int *ok)
+{
+  p = skip_blanks(p, end);
+  if (end - p < 3 || p[0] != '0' || (p[1] | 0x20) != 'x')
+  {
+    *ok = 0;
+    return p;
+  }
+  p += 2;
+
+  const char *start = p;
+  uint32_t x = 0;
+  for (; p < end; p++)
+  {
+    uint32_t c = (uint8_t)*p;
+    uint32_t d = c - '0';
+    if (d > 9)
+    {
+      d = (c | 0x20) - 'a';
+      if (d > 5)
+        break;
+      d += 10;
+    }
+    x = (x << 4) | d;
+  }
+  *ok &= (p != start);
+  *v = x;
+  return p;
+}
+
+static const char *parse_dec(const char *p, const char *end, uint8_t *v, int *ok)
+{
+  p = skip_blanks(p, end);
+  const char *start = p;
+  uint32_t x = 0;
+  for (; p < end && (uint32_t)(*p - '0') <= 9; p++)
+  {
+    x = x * 10 + (*p - '0');
+  }
+  *ok &= (p != start);
+  *v = x;
+  return p;
+}
+
+static const char *parse_text_scalar(const char *p, const char *end, branch_record *rec, int *ok)
+{
+  *ok = 1;
+  p = parse_hex(p, end, &rec->pc, ok);
+  p = parse_hex(p, end, &rec->target, ok);
+  p = parse_dec(p, end, &rec->outcome, ok);
+  p = parse_dec(p, end, &rec->condition, ok);
+  p = parse_dec(p, end, &rec->call, ok);
+  p = parse_dec(p, end, &rec->ret, ok);
+  p = parse_dec(p, end, &rec->direct, ok);
+
+  // Skip the rest of the line, including any carriage return
+  const char *nl = (const char *)memchr(p, '\n', end - p);
+  return nl ? nl + 1 : end;
+}
+
+#ifdef TRACE_PARSE_X86
+
+//------------------------------------//
+//        Vectorized Parsers          //
+//------------------------------------//
+
+// Bytes the vectorized parsers may read from the start of a line: the
+// classified window plus one 8-byte hex load past its last field
+#define WINDOW_BYTES 64
+#define SAFE_BYTES (WINDOW_BYTES + 8)
+
+// Classification of a 64-byte window, bit i describing byte i
+typedef struct
+{
+  uint64_t tab;
+  uint64_t nl;
+  uint64_t dec;   // '0'-'9'
+  uint64_t hex;   // '0'-'9', 'a'-'f', 'A'-'F'
+} line_masks;
+
+// Bits [lo, hi) set, for 0 <= lo <= hi <= 63
+static inline uint64_t bit_range(int lo, int hi)
+{
+  return ((1ULL << (hi - lo)) - 1) << lo;
+}
+
+// Decode 'len' (1 to 8) hex digits at 'q' with SWAR arithmetic: map each
+// ASCII digit to its nibble in place, then pack the nibbles pairwise
+static inline uint32_t hex_swar(const char *q, int len)
+{
+  uint64_t v;
+  memcpy(&v, q, 8);
+  v <<= 8 * (8 - len);
+
+  uint64_t letter = (v & 0x4040404040404040ULL) >> 6;
+  uint64_t x = (v & 0x0F0F0F0F0F0F0F0FULL) + letter * 9;
+  x = __builtin_bswap64(x);
+  x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+  x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+  x = (x | (x >> 16)) & 0xFFFFFFFFULL;
+  return (uint32_t)x;
+}
+
+// Check a "0x<1-8 hex digits>" field spanning bytes [s, e)
+static inline int hex_field_ok(const char *p, const line_masks *m, int s, int e)
+{
+  int digits = e - s - 2;
+  return digits >= 1 && digits <= 8 && p[s] == '0' && (p[s + 1] | 0x20) == 'x' &&
+         (m->hex & bit_range(s + 2, e)) == bit_range(s + 2, e);
+}
+
+// Decode a line of the shape branchExtractor writes: two hex fields and
+// five single-digit fields, tab separated, newline terminated
+//
+// Returns a pointer past the newline, or NULL if the line has another
+// shape and must go through the scalar parser
+//
+static inline const char *decode_line(const char *p, const line_masks *m, branch_record *rec)
+{
+  if (m->nl == 0)
+    return NULL;
+  int nl = __builtin_ctzll(m->nl);
+  uint64_t tabs = m->tab & bit_range(0, nl);
+  if (__builtin_popcountll(tabs) != 6)
+    return NULL;
+
+  int t[6];
+  for (int k = 0; k < 6; k++)
+  {
+    t[k] = __builtin_ctzll(tabs);
+    tabs &= tabs - 1;
+  }
+
+  // Single digits right after the second through sixth tab
+  uint64_t digits = 0;
+  for (int k = 1; k < 6; k++)
+    digits |= 1ULL << (t[k] + 1);
+  if (t[2] != t[1] + 2 || t[3] != t[2] + 2 || t[4] != t[3] + 2 ||
+      t[5] != t[4] + 2 || nl != t[5] + 2 || (m->dec & digits) != digits)
+    return NULL;
+  if (!hex_field_ok(p, m, 0, t[0]) || !hex_field_ok(p, m, t[0] + 1, t[1]))
+    return NULL;
+
+  rec->pc = hex_swar(p + 2, t[0] - 2);
+  rec->target = hex_swar(p + t[0] + 3, t[1] - t[0] - 3);
+  rec->outcome = p[t[1] + 1] - '0';
+  rec->condition = p[t[2] + 1] - '0';
+  rec->call = p[t[3] + 1] - '0';
+  rec->ret = p[t[4] + 1] - '0';
+  rec->direct = p[t[5] + 1] - '0';
+  return p + nl + 1;
+}
+
+// Bytes of 'v' within the signed range [lo, hi]; ASCII is non-negative,
+// so bytes >= 0x80 never match
+static inline __m128i in_range_sse2(__m128i v, char lo, char hi)
+{
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+
+static void classify_sse2(const char *p, line_masks *m)
+{
+  memset(m, 0, sizeof(*m));
+  for (int i = 0; i < WINDOW_BYTES; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i dec = in_range_sse2(v, '0', '9');
+    __m128i hex = _mm_or_si128(dec, in_range_sse2(lower, 'a', 'f'));
+    m->tab |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))) << i;
+    m->nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))) << i;
+    m->dec |= (uint64_t)(uint16_t)_mm_movemask_epi8(dec) << i;
+    m->hex |= (uint64_t)(uint16_t)_mm_movemask_epi8(hex) << i;
+  }
+}
+
+static const char *parse_text_sse2(const char *p, const char *end, branch_record *rec, int *ok)
+{
+  if (end - p >= SAFE_BYTES)
+  {
+    line_masks m;
+    classify_sse2(p, &m);
+    const char *next = decode_line(p, &m, rec);
+    if (next != NULL)
+    {
+      *ok = 1;
+      return next;
+    }
+  }
+  return parse_text_scalar(p, end, rec, ok);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i in_range_avx2(__m256i v, char lo, char hi)
+{
+  return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char *p, line_masks *m)
+{
+  memset(m, 0, sizeof(*m));
+  for (int i = 0; i < WINDOW_BYTES; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i dec = in_range_avx2(v, '0', '9');
+    __m256i hex = _mm256_or_si256(dec, in_range_avx2(lower, 'a', 'f'));
+    m->tab |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))) << i;
+    m->nl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))) << i;
+    m->dec |= (uint64_t)(uint32_t)_mm256_movemask_epi8(dec) << i;
+    m->hex |= (uint64_t)(uint32_t)_mm256_movemask_epi8(hex) << i;
+  }
+}
+
+__attribute__((target("avx2")))
+static const char *parse_text_avx2(const char *p, const char *end, branch_record *rec, int *ok)
+{
+  if (end - p >= SAFE_BYTES)
+  {
+    line_masks m;
+    classify_avx2(p, &m);
+    const char *next = decode_line(p, &m, rec);
+    if (next != NULL)
+    {
+      *ok = 1;
+      return next;
+    }
+  }
+  return parse_text_scalar(p, end, rec, ok);
+}
+
+#endif
+
+//------------------------------------//
+//          Parser Selection          //
+//------------------------------------//
+
+typedef const char *(*text_parser_fn)(const char *, const char *, branch_record *, int *);
+
+static text_parser_fn parsers[3] = {
+    parse_text_scalar,
+#ifdef TRACE_PARSE_X86
+    parse_text_sse2,
+    parse_text_avx2,
+#else
+    NULL,
+    NULL,
+#endif
+};
+
+static int parser_supported(int kind)
+{
+  if (kind < PARSE_SCALAR || kind > PARSE_AVX2 || parsers[kind] == NULL)
+    return 0;
+#ifdef TRACE_PARSE_X86
+  // May run from a static initializer, before libgcc probed the CPU
+  __builtin_cpu_init();
+  if (kind == PARSE_AVX2)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return 1;
+}
+
+static int best_parser()
+{
+  for (int kind = PARSE_AVX2; kind > PARSE_SCALAR; kind--)
+  {
+    if (parser_supported(kind))
+      return kind;
+  }
+  return PARSE_SCALAR;
+}
+
+int traceParser = best_parser();
+static text_parser_fn text_parser = parsers[traceParser];
+
+int trace_select_parser(int kind)
+{
+  if (!parser_supported(kind))
+    return 0;
+  traceParser = kind;
+  text_parser = parsers[kind];
+  return 1;
+}
+
+const char *trace_parse_text(const char *p, const char *end, branch_record *rec, int *ok)
+{
+  return text_parser(p, end, rec, ok);
+}